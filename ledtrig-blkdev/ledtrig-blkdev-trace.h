@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ *	Block device LED trigger - tracepoints
+ *
+ *	Copyright 2021-2023 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ledtrig_blkdev
+
+#if !defined(_LEDTRIG_BLKDEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LEDTRIG_BLKDEV_TRACE_H
+
+#include <linux/kdev_t.h>
+#include <linux/leds.h>
+#include <linux/part_stat.h>
+#include <linux/tracepoint.h>
+
+/* Start of a run of the delayed work */
+TRACE_EVENT(blkdev_trig_check_start,
+
+	TP_PROTO(bool kicked, s64 late_ns),
+
+	TP_ARGS(kicked, late_ns),
+
+	TP_STRUCT__entry(
+		__field(bool,	kicked)
+		__field(s64,	late_ns)
+	),
+
+	TP_fast_assign(
+		__entry->kicked		= kicked;
+		__entry->late_ns	= late_ns;
+	),
+
+	TP_printk("kicked=%d late_ns=%lld", __entry->kicked, __entry->late_ns)
+);
+
+/* End of a run of the delayed work */
+TRACE_EVENT(blkdev_trig_check_end,
+
+	TP_PROTO(unsigned int leds, s64 next_ns),
+
+	TP_ARGS(leds, next_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int,	leds)
+		__field(s64,		next_ns)
+	),
+
+	TP_fast_assign(
+		__entry->leds		= leds;
+		__entry->next_ns	= next_ns;
+	),
+
+	TP_printk("leds=%u next_ns=%lld", __entry->leds, __entry->next_ns)
+);
+
+/* A block device's activity counters have been read */
+TRACE_EVENT(blkdev_trig_update_btb,
+
+	TP_PROTO(dev_t dev, const unsigned long *ios, unsigned long changed),
+
+	TP_ARGS(dev, ios, changed),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		dev)
+		__field(unsigned long,	read)
+		__field(unsigned long,	write)
+		__field(unsigned long,	discard)
+		__field(unsigned long,	flush)
+		__field(unsigned long,	changed)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= dev;
+		__entry->read		= ios[STAT_READ];
+		__entry->write		= ios[STAT_WRITE];
+		__entry->discard	= ios[STAT_DISCARD];
+		__entry->flush		= ios[STAT_FLUSH];
+		__entry->changed	= changed;
+	),
+
+	TP_printk("dev=%d:%d read=%lu write=%lu discard=%lu flush=%lu changed=%#lx",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->read, __entry->write, __entry->discard,
+		  __entry->flush, __entry->changed)
+);
+
+/* An LED has been blinked */
+TRACE_EVENT(blkdev_trig_blink,
+
+	TP_PROTO(const struct led_classdev *led, unsigned long delay_on),
+
+	TP_ARGS(led, delay_on),
+
+	TP_STRUCT__entry(
+		__string(led,		led->name)
+		__field(unsigned long,	delay_on)
+	),
+
+	TP_fast_assign(
+		__assign_str(led, led->name);
+		__entry->delay_on	= delay_on;
+	),
+
+	TP_printk("led=%s delay_on=%lu", __get_str(led), __entry->delay_on)
+);
+
+#endif	/* _LEDTRIG_BLKDEV_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ledtrig-blkdev-trace
+#include <trace/define_trace.h>
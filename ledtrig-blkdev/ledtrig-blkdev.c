@@ -6,11 +6,34 @@
  *	Copyright 2021-2023 Ian Pilcher <arequipeno@gmail.com>
  */
 
+#include <linux/blk-mq.h>
 #include <linux/blkdev.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
 #include <linux/leds.h>
 #include <linux/module.h>
 #include <linux/part_stat.h>
+#include <linux/pm_runtime.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/suspend.h>
+#include <linux/sysfs.h>
+#include <linux/tracepoint.h>
 #include <linux/xarray.h>
+#include <scsi/scsi_device.h>
+#include <scsi/scsi_host.h>
+#include <scsi/scsi_proto.h>
+
+#include "ledtrig-blkdev.h"
+
+#define CREATE_TRACE_POINTS
+#include "ledtrig-blkdev-trace.h"
 
 /**
  * DOC: Overview
@@ -29,6 +52,159 @@
  * block devices have been linked to the BTL's LED.  Thus, a block device can
  * be linked to more than one LED, and an LED can be linked to more than one
  * block device.
+ *
+ * BTLs whose LEDs are linked to at least one block device are kept in a
+ * red-black tree (&blkdev_trig_sched), ordered by the time at which each LED is
+ * next due to be checked.  Each run of the delayed work only visits the LEDs
+ * that are actually due, rather than every LED associated with the trigger.
+ *
+ * The delayed work never takes &blkdev_trig_mutex, which serializes only
+ * changes to the links between LEDs and block devices.  It walks the
+ * &xarray-based link tables under the RCU read lock, and BTBs and BTLs are not
+ * freed until any concurrent check has finished with them.  Thus, a slow
+ * &sysfs write (e.g. one that blocks while opening a resetting disk) cannot
+ * delay or stall the activity checks.
+ *
+ * An LED can optionally be switched to event-driven mode (via its
+ * &event_driven attribute).  Such an LED is not part of the periodic schedule.
+ * Instead, a probe attached to the ``block_rq_complete`` tracepoint records the
+ * type of each completed request in the BTB of its block device (and of the
+ * whole disk, if the device is a partition) and kicks the delayed work to run
+ * immediately.  Block devices that aren't linked to any event-driven LED are
+ * ignored by the probe.  This mode is only available if the kernel supports
+ * tracepoints; otherwise, LEDs continue to use periodic polling.
+ *
+ * If an LED's &link_slaves attribute is set, linking a stacked block device
+ * (e.g. an MD RAID array or a device-mapper volume) to the LED instead links
+ * the physical block devices beneath it, found through the block layer's
+ * ``slaves`` links (in &kernfs, without opening any files).  The LED then
+ * shares the BTBs of those devices with any per-disk LEDs, so each disk's
+ * counters are still read only once per check, and the stacked device itself
+ * is never sampled.
+ *
+ * The delayed work runs on the trigger's own workqueue (``ledtrig-blkdev``),
+ * so that LED checks aren't delayed behind writeback or RAID resync work on
+ * the system workqueue.  By default, the workqueue is high-priority and
+ * unbound.  An unbound workqueue is visible in
+ * ``/sys/devices/virtual/workqueue/ledtrig-blkdev/``, so it can be kept off the
+ * CPUs that handle storage and network interrupts by writing its &cpumask
+ * attribute.  The workqueue's flags are set by module parameters.
+ *
+ * All times are kept as &ktime_t values.  By default, the delayed work is
+ * scheduled with the workqueue's timer, so check intervals are rounded up to
+ * whole jiffies (e.g. a 25 millisecond interval becomes 30 milliseconds when
+ * &HZ is 100).  If the &hrtimer module parameter is set, the work is instead
+ * queued by a high-resolution timer, so that intervals are honored precisely.
+ * The &timer_slack_us module parameter allows the kernel to delay the timer
+ * slightly, so that its expiry can be combined with other timers' to save
+ * power.
+ *
+ * LEDs with different check intervals would normally fall due at unrelated
+ * times, each causing a separate wakeup.  If the &check_grid_us module
+ * parameter is set, each LED's due time is rounded to the nearest multiple of
+ * the grid (on the monotonic clock), so LEDs whose due times are close to each
+ * other are checked by the same run of the delayed work.  The
+ * &check_tolerance_us parameter also lets each run check any LED that will be
+ * due within that window, rather than running again shortly afterwards.
+ *
+ * On a large JBOD, a run of the delayed work may find thousands of links due
+ * at once.  If the &check_budget_us module parameter is set, a run stops
+ * reading counters once that much time has elapsed since it started (wall-clock
+ * time, including any time the work was preempted), checks the LEDs whose
+ * block devices it has read, and leaves the remaining due LEDs (the least
+ * overdue ones) in the schedule for another run, which follows immediately.
+ * The budget is a soft limit: it is only tested after all of an LED's block
+ * devices have been read, and the LEDs that were read are still checked (and
+ * blinked) afterwards, so a run can exceed it.  Each run is also a single RCU
+ * read-side critical section from start to finish, so the budget doesn't bound
+ * RCU read-side latency.  The &sysfs_links module parameter can also be
+ * cleared, so that links don't create the &linked_leds and &linked_devices
+ * symlinks (two &sysfs nodes per link, plus a &linked_leds directory per block
+ * device).
+ *
+ * The delayed work is parked while the system suspends or hibernates.  On
+ * resume, the counters of every linked block device are re-read without
+ * recording activity, so the I/O done while resuming doesn't blink every LED
+ * at once.  If the &skip_suspended module parameter is set, the counters of a
+ * block device whose parent device (e.g. the SCSI device of a disk) is
+ * runtime-suspended are not read at all; a runtime-suspended device can't be
+ * doing any I/O.
+ *
+ * If the &quick_check module parameter is set, the counters of a block device
+ * whose I/O timestamp (&bd_stamp) hasn't changed since they were last read are
+ * not read either.  Flushes don't update the timestamp, so for an LED that
+ * blinks on flushes (the default), only the flush counter of such a device is
+ * read.
+ */
+
+/**
+ * DOC: Benchmarking
+ *
+ * If the kernel supports &debugfs, the trigger creates a ``ledtrig-blkdev``
+ * directory in it, which can be used to measure the cost of the trigger.
+ *
+ * * ``stats_enabled`` --- Write ``1`` to start collecting statistics (``0`` by
+ *   default, so that a production system doesn't pay for timestamps).
+ *
+ * * ``stats`` --- The number of runs of the delayed work, the number of LEDs
+ *   checked, blinks issued and block device counter reads (BTB updates) and
+ *   reads skipped by quick checks (see the ``quick_check`` parameter), the
+ *   elapsed (wall-clock) time of each run, how late each scheduled run started
+ *   relative to &blkdev_trig_next_check, and (for event-driven LEDs) the
+ *   latency from I/O completion to LED blink.  Times are shown as power-of-2
+ *   histograms.  The statistics are approximate: the histograms and most
+ *   counters are updated without atomic operations, and a run during which
+ *   ``stats_enabled`` is changed is only partly counted.
+ *
+ * * ``stats_reset`` --- Write anything to reset the statistics.
+ *
+ * * ``devices`` --- The activity counters of every linked block device, as of
+ *   the trigger's most recent sample, and the age of its most recent activity
+ *   of each type.  (This is always available, regardless of ``stats_enabled``,
+ *   and can be used by monitoring tools instead of ``/sys/block/*/stat``.)
+ *
+ * * ``bench_leds`` --- Write a number to create that many dummy LEDs
+ *   (``blkdev-bench:0``, ``blkdev-bench:1``, etc.) that use the ``blkdev``
+ *   trigger, or ``0`` to remove them.  The dummy LEDs can be linked to any
+ *   block devices (e.g. ``null_blk`` devices) under a controlled I/O load to
+ *   simulate a large enclosure.
+ *
+ * * ``bench_link`` --- Write a list of block device names (as for
+ *   &link_dev_by_name) to link every dummy LED to all of them, e.g. 1000 dummy
+ *   LEDs and 10 ``null_blk`` devices for 10,000 links.  Removing the dummy LEDs
+ *   removes their links.
+ *
+ * A 10,000-link stress test, with the LEDs on a common grid so that they are
+ * all due in the same runs::
+ *
+ *   modprobe null_blk nr_devices=10
+ *   echo 100000 > /sys/module/ledtrig_blkdev/parameters/check_grid_us
+ *   cd /sys/kernel/debug/ledtrig-blkdev
+ *   echo 1000 > bench_leds
+ *   echo nullb0 nullb1 nullb2 nullb3 nullb4 \
+ *        nullb5 nullb6 nullb7 nullb8 nullb9 > bench_link
+ *   echo 1 > stats_reset
+ *   echo 1 > stats_enabled
+ *   fio --name=load --rw=randrw --time_based --runtime=60 \
+ *       --filename=/dev/nullb0:/dev/nullb1:/dev/nullb2:/dev/nullb3:/dev/nullb4
+ *   cat stats
+ *   echo 0 > stats_enabled
+ *   echo 0 > bench_leds
+ *
+ * With the default 100 millisecond check interval, ``stats`` should then show
+ * about 10 runs per second of ``elapsed``, and about 1000 ``leds checked`` per
+ * run.  ``btb updates`` plus ``btb updates skipped`` should be at most 10 per
+ * run -- each block device's counters are read once per run, however many
+ * LEDs are linked to it -- and ``blinks`` should be up to 1000 per run (every
+ * LED is linked to the loaded devices).  With ``check_budget_us`` set below the
+ * ``run time`` average, ``deferred`` counts the LEDs pushed into extra runs.
+ * The ``run time`` histogram is the result to record for comparison.
+ *
+ * The ``ledtrig_blkdev`` tracepoints (``blkdev_trig_check_start``,
+ * ``blkdev_trig_check_end``, ``blkdev_trig_update_btb`` and
+ * ``blkdev_trig_blink``) record the same events individually, so that a slow
+ * check can be attributed to workqueue latency, to reading the counters, or to
+ * the LED driver.
  */
 
 /* Default, minimum & maximum blink duration (milliseconds) */
@@ -36,30 +212,71 @@
 #define BLKDEV_TRIG_BLINK_MIN	10
 #define BLKDEV_TRIG_BLINK_MAX	86400000  /* 24 hours */
 
+/*
+ * Number of consecutive checks that must find activity on an LED's block
+ * devices before the LED is switched to hardware blinking (if enabled).
+ */
+#define BLKDEV_TRIG_HW_BLINK_CHECKS	3
+
 /* Default, minimum & maximum activity check interval (milliseconds) */
 #define BLKDEV_TRIG_CHECK_DEF	100
 #define BLKDEV_TRIG_CHECK_MIN	25
 #define BLKDEV_TRIG_CHECK_MAX	86400000  /* 24 hours */
 
 /*
- * If blkdev_trig_check() can't lock the mutex, how long to wait before trying
- * again (milliseconds)
+ * Number of consecutive checks that find no activity on any of an LED's block
+ * devices before the LED's check interval begins to back off
+ */
+#define BLKDEV_TRIG_IDLE_CHECKS	10
+
+/*
+ * Default, minimum & maximum I/O rate (operations per second) at which an LED
+ * in intensity mode reaches full brightness
  */
-#define BLKDEV_TRIG_CHECK_RETRY	5
+#define BLKDEV_TRIG_FULL_DEF	1000
+#define BLKDEV_TRIG_FULL_MIN	1
+#define BLKDEV_TRIG_FULL_MAX	10000000
+
+/*
+ * Maximum blink thresholds (operations or sectors since the last check); larger
+ * values are almost certainly mistakes
+ */
+#define BLKDEV_TRIG_MIN_IOS_MAX		10000000
+#define BLKDEV_TRIG_MIN_SECTORS_MAX	2147483648U	/* 1 TiB */
 
 /**
  * struct blkdev_trig_bdev - Trigger-specific data about a block device.
- * @last_checked:	Time (in jiffies) at which the trigger last checked this
- *			block device for activity.
- * @last_activity:	Time (in jiffies) at which the trigger last detected
- *			activity of each type.
+ * @last_any:		Most recent of the timestamps in &last_activity.
+ * @last_checked:	Time at which the trigger last checked this block device
+ *			for activity.
+ * @bdev:		The block device.
  * @ios:		Activity counter values for each type, corresponding to
  *			the timestamps in &last_activity.
- * @index:		&xarray index, so the BTB can be included in one or more
- *			&blkdev_trig_led.linked_btbs.
- * @bdev:		The block device.
+ * @stamp:		Value of the block device's &bd_stamp when &ios was
+ *			read, or a value that &bd_stamp can no longer have if
+ *			&ios might not reflect all I/O in that jiffy.
+ * @last_full:		Time at which &ios was last read.
+ * @last_flush:		Time at which &ios[&STAT_FLUSH] was last read (by itself
+ *			or with the other counters).
+ * @pending:		Bitmask of the types of activity that have been reported
+ *			by the ``block_rq_complete`` tracepoint probe but not
+ *			yet processed by the delayed work.
+ * @last_activity:	Time at which the trigger last detected activity of each
+ *			type.
+ * @sectors:		Sector counter values for each type, as of the most
+ *			recent change of &ios.
  * @linked_btls:	The BTLs that represent the LEDs linked to the BTB's
  *			block device.
+ * @event_ns:		Time (in nanoseconds) of the oldest event in &pending,
+ *			if statistics are enabled.
+ * @event_leds:		Number of event-driven LEDs linked to the block device.
+ *			The tracepoint probe ignores the block device if this is
+ *			&0.
+ * @index:		&xarray index, so the BTB can be included in one or more
+ *			&blkdev_trig_led.linked_btbs.
+ * @name_node:		The BTB's entry in &blkdev_trig_names.
+ * @rcu:		Defers freeing the BTB until any concurrent check has
+ *			finished with it.
  *
  * Every block device linked to at least one LED gets a "BTB."  A BTB is created
  * when a block device that is not currently linked to any LEDs is linked to an
@@ -75,74 +292,289 @@
  *   (which happens automatically if the LED device is removed from the system).
  *
  * * The BTB's block device is removed from the system.  To accomodate this
- *   scenario, BTB's are created as device resources, so that the release
- *   function will be called by the driver core when the device is removed.
+ *   scenario, each BTB is tied to a device resource that points to it, so that
+ *   the release function will be called by the driver core when the device is
+ *   removed.
+ *
+ * BTBs are allocated from &blkdev_trig_btb_cache, aligned to cache lines.  The
+ * fields are ordered by how often the delayed work uses them.  A check of an
+ * idle block device only touches the first group, which fits in a single
+ * 64-byte cache line on 64-bit systems.
  */
 struct blkdev_trig_bdev {
-	unsigned long		last_checked;
-	unsigned long		last_activity[NR_STAT_GROUPS];
-	unsigned long		ios[NR_STAT_GROUPS];
-	unsigned long		index;
+	/* Every check */
+	ktime_t			last_any;
+	ktime_t			last_checked;
 	struct block_device	*bdev;
+	unsigned long		ios[NR_STAT_GROUPS];
+	unsigned long		stamp;
+
+	/* Only after activity or events, or without quick checks */
+	ktime_t			last_full;
+	ktime_t			last_flush;
+	unsigned long		pending;  /* must be ulong for atomic bit ops */
+	ktime_t			last_activity[NR_STAT_GROUPS];
+	unsigned long		sectors[NR_STAT_GROUPS];
 	struct xarray		linked_btls;
+	u64			event_ns;
+	unsigned int		event_leds;
+
+	/* Only when links change */
+	unsigned long		index;
+	struct rhash_head	name_node;
+	struct rcu_head		rcu;
 };
 
 /**
  * struct blkdev_trig_led - Trigger-specific data about an LED.
- * @last_checked:	Time (in jiffies) at which the trigger last checked the
- *			the block devices linked to this LED for activity.
- * @index:		&xarray index, so the BTL can be included in one or more
- *			&blkdev_trig_bdev.linked_btls.
+ * @next_check:		Time at which the trigger is next due to check the block
+ *			devices linked to this LED.
+ * @sched_node:		The BTL's node in &blkdev_trig_sched (only while the LED
+ *			is linked to at least one block device).
+ * @due_node:		The BTL's node in the list of LEDs that are due to be
+ *			checked by the current run of the delayed work.
+ * @last_checked:	Time at which the trigger last checked the the block
+ *			devices linked to this LED for activity.
  * @mode:		Bitmask for types of block device activity that will
  *			cause this LED to blink --- reads, writes, discards,
  *			etc.
- * @led:		The LED device.
- * @blink_msec:		Duration of a blink (milliseconds).
- * @check_jiffies:	Frequency with which block devices linked to this LED
- *			should be checked for activity (jiffies).
  * @linked_btbs:	The BTBs that represent the block devices linked to the
  *			BTL's LED.
- * @all_btls_node:	The BTL's node in the module's list of all BTLs.
+ * @cur_interval:	Current (possibly backed off) interval between checks
+ *			(protected by &blkdev_trig_sched_lock).
+ * @check_interval:	Frequency with which block devices linked to this LED
+ *			should be checked for activity.
+ * @max_interval:	Maximum interval to which the check frequency backs off
+ *			while the LED's block devices are idle.  &0 disables
+ *			backoff.
+ * @led:		The LED device.
+ * @blink_msec:		Duration of a blink (milliseconds).
+ * @min_ios:		Minimum number of operations (of the types selected by
+ *			&mode, on all of the LED's block devices combined) since
+ *			the last check for the LED to blink.  &0 disables the
+ *			threshold.
+ * @min_sectors:	Minimum number of sectors transferred, as for &min_ios.
+ * @idle_checks:	Number of consecutive checks that have found no activity
+ *			on any block device linked to this LED (protected by
+ *			&blkdev_trig_sched_lock).
+ * @busy_checks:	Number of consecutive checks that have blinked the LED.
+ * @scheduled:		Whether the LED is linked to at least one block device
+ *			and is not event-driven, and should therefore be
+ *			(re-)inserted into &blkdev_trig_sched.
+ * @event_driven:	Whether the LED is blinked in response to events from
+ *			the ``block_rq_complete`` tracepoint, rather than by
+ *			periodic polling.
+ * @intensity_mode:	Whether the LED shows the I/O rate of its block devices
+ *			(as brightness or blink duration), rather than simply
+ *			blinking when activity occurs.
+ * @hw_blink:		Whether sustained activity is shown by the LED driver's
+ *			hardware blinking, rather than by a software blink after
+ *			every check.
+ * @hw_blinking:	Whether the LED is currently blinking in hardware.
+ * @intensity_full:	I/O rate (operations per second) at which an LED in
+ *			intensity mode reaches full brightness.
+ * @intensity_level:	Brightness most recently set in intensity mode.
+ * @link_gen:		Incremented whenever a block device is linked to or
+ *			unlinked from the LED.
+ * @snap_gen:		Value of &link_gen when &snap_ios was recorded.
+ * @snap_mode:		Value of &mode when &snap_ios was recorded.
+ * @snap_ios:		Sum of the activity counters (of the types selected by
+ *			&mode) of all block devices linked to the LED, as of
+ *			&snap_time.
+ * @snap_sectors:	Sum of the sector counters, as for &snap_ios.
+ * @snap_time:		Time at which &snap_ios was recorded.
+ * @index:		&xarray index, so the BTL can be included in one or more
+ *			&blkdev_trig_bdev.linked_btls.
+ * @rule_node:		The BTL's entry in &blkdev_trig_rule_btls, if it has a
+ *			hotplug linking rule.
+ * @rule:		SCSI host, channel, target and LUN of disks that are
+ *			automatically linked to the LED (&-1 matches any value).
+ * @link_slaves:	Whether linking a stacked block device to the LED links
+ *			its physical member devices instead.
+ * @rcu:		Defers freeing the BTL until any concurrent check has
+ *			finished with it.
  *
  * Every LED associated with the block device trigger gets a "BTL."  A BTL is
  * created when the trigger is "activated" on an LED (usually by writing
  * ``blkdev`` to the LED's &sysfs &trigger attribute).  A BTL is freed wnen its
  * LED is disassociated from the trigger, either through the trigger's &sysfs
  * interface or because the LED device is removed from the system.
+ *
+ * Like BTBs, BTLs are allocated from a cache-line-aligned cache
+ * (&blkdev_trig_btl_cache), with the fields used by the schedule walk in the
+ * first cache line.
  */
 struct blkdev_trig_led {
-	unsigned long		last_checked;
-	unsigned long		index;
+	/* Schedule walk */
+	ktime_t			next_check;
+	struct rb_node		sched_node;
+	struct list_head	due_node;
+	ktime_t			last_checked;
 	unsigned long		mode;  /* must be ulong for atomic bit ops */
+
+	/* Every check */
+	struct xarray		linked_btbs;
+	ktime_t			cur_interval;
+	ktime_t			check_interval;
+	ktime_t			max_interval;
 	struct led_classdev	*led;
 	unsigned int		blink_msec;
-	unsigned int		check_jiffies;
-	struct xarray		linked_btbs;
-	struct hlist_node	all_btls_node;
+	unsigned int		min_ios;
+	unsigned int		min_sectors;
+	unsigned int		idle_checks;
+	unsigned int		busy_checks;
+	bool			scheduled;
+	bool			event_driven;
+	bool			intensity_mode;
+	bool			hw_blink;
+	bool			hw_blinking;
+
+	/* Intensity mode & thresholds */
+	unsigned int		intensity_full;
+	unsigned int		intensity_level;
+	unsigned int		link_gen;
+	unsigned int		snap_gen;
+	unsigned long		snap_mode;
+	unsigned long		snap_ios;
+	unsigned long		snap_sectors;
+	ktime_t			snap_time;
+
+	/* Only when links or rules change */
+	unsigned long		index;
+	struct list_head	rule_node;
+	int			rule[4];
+	bool			link_slaves;
+	struct rcu_head		rcu;
 };
 
-/* Protects everything except atomic LED attributes */
+/* Serializes link changes; not taken by the delayed work */
 static DEFINE_MUTEX(blkdev_trig_mutex);
 
+/* Protects the schedule (blkdev_trig_sched & BTLs' next_check/scheduled) */
+static DEFINE_SPINLOCK(blkdev_trig_sched_lock);
+
 /* BTB device resource release function */
 static void blkdev_trig_btb_release(struct device *dev, void *res);
 
+/* Slab caches for BTBs and BTLs */
+static struct kmem_cache *blkdev_trig_btb_cache;
+static struct kmem_cache *blkdev_trig_btl_cache;
+
 /* Index for next BTB or BTL */
 static unsigned long blkdev_trig_next_index;
 
-/* All LEDs associated with the trigger */
-static HLIST_HEAD(blkdev_trig_all_btls);
+/* LEDs linked to at least 1 block device, ordered by next_check */
+static struct rb_root_cached blkdev_trig_sched = RB_ROOT_CACHED;
 
 /* Delayed work to periodically check for activity & blink LEDs */
 static void blkdev_trig_check(struct work_struct *work);
 static DECLARE_DELAYED_WORK(blkdev_trig_work, blkdev_trig_check);
 
-/* When is the delayed work scheduled to run next (jiffies) */
-static unsigned long blkdev_trig_next_check;
+/* Workqueue on which the delayed work runs */
+static struct workqueue_struct *blkdev_trig_wq;
+
+/* Queues the delayed work in hrtimer mode */
+static struct hrtimer blkdev_trig_timer;
+
+/* Schedule the delayed work with an hrtimer (module parameter) */
+static bool blkdev_trig_use_hrtimer;
+module_param_named(hrtimer, blkdev_trig_use_hrtimer, bool, 0444);
+MODULE_PARM_DESC(hrtimer,
+		 "Schedule activity checks with a high-resolution timer (default: N)");
+
+/* Slack for the hrtimer, in microseconds (module parameter) */
+static unsigned int blkdev_trig_slack_us = 1000;
+module_param_named(timer_slack_us, blkdev_trig_slack_us, uint, 0644);
+MODULE_PARM_DESC(timer_slack_us,
+		 "Slack allowed for the high-resolution timer, in microseconds (default: 1000)");
+
+/* Grid onto which LEDs' due times are rounded, in microseconds (module parameter) */
+static unsigned int blkdev_trig_grid_us;
+module_param_named(check_grid_us, blkdev_trig_grid_us, uint, 0644);
+MODULE_PARM_DESC(check_grid_us,
+		 "Round LEDs' check times to a shared grid, in microseconds (default: 0 = disabled)");
+
+/* Window within which LEDs are checked early, in microseconds (module parameter) */
+static unsigned int blkdev_trig_tolerance_us;
+module_param_named(check_tolerance_us, blkdev_trig_tolerance_us, uint, 0644);
+MODULE_PARM_DESC(check_tolerance_us,
+		 "Check LEDs that are due within this many microseconds early (default: 0)");
+
+/* Elapsed time after which a run defers due LEDs (module parameter) */
+static unsigned int blkdev_trig_budget_us;
+module_param_named(check_budget_us, blkdev_trig_budget_us, uint, 0644);
+MODULE_PARM_DESC(check_budget_us,
+		 "Defer the remaining due LEDs to another run after this many microseconds (default: 0 = no limit)");
+
+/* Create linked_leds & linked_devices symlinks (module parameter) */
+static bool blkdev_trig_sysfs_links = true;
+module_param_named(sysfs_links, blkdev_trig_sysfs_links, bool, 0444);
+MODULE_PARM_DESC(sysfs_links,
+		 "Show links in sysfs linked_leds & linked_devices directories (default: Y)");
+
+/* Workqueue flags (module parameters) */
+static bool blkdev_trig_wq_highpri = true;
+module_param_named(wq_highpri, blkdev_trig_wq_highpri, bool, 0444);
+MODULE_PARM_DESC(wq_highpri, "Use a high-priority workqueue (default: Y)");
+
+static bool blkdev_trig_wq_unbound = true;
+module_param_named(wq_unbound, blkdev_trig_wq_unbound, bool, 0444);
+MODULE_PARM_DESC(wq_unbound,
+		 "Use an unbound workqueue, with CPU affinity configurable via sysfs (default: Y)");
+
+static bool blkdev_trig_wq_freezable;
+module_param_named(wq_freezable, blkdev_trig_wq_freezable, bool, 0444);
+MODULE_PARM_DESC(wq_freezable,
+		 "Freeze the workqueue during system suspend (default: N)");
+
+/* Skip reading the counters of block devices that are idle (module parameter) */
+static bool blkdev_trig_quick_check;
+module_param_named(quick_check, blkdev_trig_quick_check, bool, 0644);
+MODULE_PARM_DESC(quick_check,
+		 "Use the I/O timestamp to skip reading the counters of idle devices; only the flush counter is read for LEDs with blink_on_flush (default: N)");
+
+/* Skip reading the counters of runtime-suspended devices (module parameter) */
+static bool blkdev_trig_skip_suspended;
+module_param_named(skip_suspended, blkdev_trig_skip_suspended, bool, 0644);
+MODULE_PARM_DESC(skip_suspended,
+		 "Don't read the counters of devices that are runtime-suspended (default: N)");
+
+/* When is the delayed work scheduled to run next */
+static ktime_t blkdev_trig_next_check;
+
+/* All BTBs, indexed by device number (for the tracepoint probe) */
+static DEFINE_XARRAY_FLAGS(blkdev_trig_btbs, XA_FLAGS_LOCK_IRQ);
+
+/* All BTBs, indexed by block device name (see blkdev_trig_names_params) */
+static struct rhashtable blkdev_trig_names;
+
+/* Mark for BTBs in blkdev_trig_btbs with pending events */
+#define BLKDEV_TRIG_PENDING	XA_MARK_1
+
+/* Bit 0 is set when an event has kicked the delayed work */
+static unsigned long blkdev_trig_kicked;
+
+/*
+ * Delayed work parked for system suspend (written under blkdev_trig_sched_lock,
+ * but read locklessly by blkdev_trig_mark(); see blkdev_trig_suspend())
+ */
+static bool blkdev_trig_suspended;
+
+/* Number of event-driven LEDs (tracepoint probe registered if non-zero) */
+static unsigned int blkdev_trig_event_leds;
 
 /* Total number of BTB-to-BTL links */
 static unsigned int blkdev_trig_link_count;
 
+/* BTLs with hotplug linking rules */
+static LIST_HEAD(blkdev_trig_rule_btls);
+
+/* The block device class (not exported; learned by blkdev_trig_init()) */
+static const struct class *blkdev_trig_block_class;
+
+/* The device type of whole disks (not exported; learned with the class) */
+static const struct device_type *blkdev_trig_disk_type;
+
 /* Empty sysfs attribute list for next 2 declarations */
 static struct attribute *blkdev_trig_attrs_empty[] = { NULL };
 
@@ -161,1011 +593,4247 @@ static const struct attribute_group blkdev_trig_linked_devs = {
 
 /*
  *
- *	Delayed work to check for activity & blink LEDs
+ *	Statistics (debugfs benchmarking harness)
  *
  */
 
+#ifdef CONFIG_DEBUG_FS
+
+/* Number of buckets in power-of-2 histograms (last bucket is open-ended) */
+#define BLKDEV_TRIG_HIST_BUCKETS	24
+
 /**
- * blkdev_trig_blink() - Blink an LED, if the correct type of activity has
- *	occurred on the block device.
- * @btl:	The BTL that represents the LED
- * @btb:	The BTB that represents the block device
- *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
- * Return:	&true if the LED is blinked, &false if not.
+ * struct blkdev_trig_hist - A power-of-2 histogram.
+ * @count:	Number of samples in each bucket.  Bucket &0 counts samples with
+ *		value &0; bucket &n counts values from 2^(n-1) to 2^n - 1.
+ * @samples:	Total number of samples.
+ * @total:	Sum of all samples.
+ * @max:	Largest sample.
  */
-static bool blkdev_trig_blink(const struct blkdev_trig_led *btl,
-			      const struct blkdev_trig_bdev *btb)
-{
-	unsigned long mode, mask, delay_on, delay_off;
-	enum stat_group i;
+struct blkdev_trig_hist {
+	unsigned long	count[BLKDEV_TRIG_HIST_BUCKETS];
+	unsigned long	samples;
+	u64		total;
+	u64		max;
+};
 
-	mode = READ_ONCE(btl->mode);
+/**
+ * struct blkdev_trig_stats - Statistics about the delayed work.
+ * @start_ns:	Time (in nanoseconds) at which the statistics were reset.
+ * @runs:	Number of runs of the delayed work.
+ * @kicked:	Number of runs that were kicked by an event.
+ * @leds:	Number of LEDs checked.
+ * @blinks:	Number of blinks issued.
+ * @reads:	Number of block device counter reads.
+ * @skips:	Number of block device counter reads skipped by quick checks.
+ * @deferred:	Number of due LEDs deferred to another run by the time budget.
+ * @tick_ns:	Elapsed (wall-clock) time of each run (nanoseconds).
+ * @late_us:	Lateness of each scheduled run (microseconds).
+ * @blink_us:	Latency from I/O completion to blink of event-driven LEDs
+ *		(microseconds).
+ *
+ * All fields except &reads and &skips are only updated by the delayed work,
+ * which never runs concurrently with itself.  They are read by
+ * blkdev_trig_stats_show() without synchronization, and a run during which
+ * &blkdev_trig_stats_enabled changes is only partly counted, so the statistics
+ * are approximate.
+ */
+struct blkdev_trig_stats {
+	u64			start_ns;
+	unsigned long		runs;
+	unsigned long		kicked;
+	unsigned long		leds;
+	unsigned long		blinks;
+	atomic_long_t		reads;
+	atomic_long_t		skips;
+	unsigned long		deferred;
+	struct blkdev_trig_hist	tick_ns;
+	struct blkdev_trig_hist	late_us;
+	struct blkdev_trig_hist	blink_us;
+};
 
-	for (i = STAT_READ, mask = 1; i <= STAT_FLUSH; ++i, mask <<= 1) {
+static struct blkdev_trig_stats blkdev_trig_stats;
 
-		if (!(mode & mask))
-			continue;
+/* Statistics are only collected when enabled via debugfs */
+static bool blkdev_trig_stats_enabled;
 
-		if (time_before_eq(btb->last_activity[i], btl->last_checked))
-			continue;
+/* Bit 0 is set when a reset has been requested (performed by delayed work) */
+static unsigned long blkdev_trig_stats_reset;
 
-		delay_on = READ_ONCE(btl->blink_msec);
-		delay_off = 1;	/* 0 leaves LED turned on */
+/**
+ * blkdev_trig_hist_add() - Add a sample to a histogram.
+ * @hist:	The histogram
+ * @value:	The sample
+ *
+ * Context:	Delayed work.
+ */
+static void blkdev_trig_hist_add(struct blkdev_trig_hist *hist, u64 value)
+{
+	unsigned int bucket;
 
-		led_blink_set_oneshot(btl->led, &delay_on, &delay_off, 0);
-		return true;
-	}
+	bucket = min_t(unsigned int, fls64(value), BLKDEV_TRIG_HIST_BUCKETS - 1);
 
-	return false;
+	++hist->count[bucket];
+	++hist->samples;
+	hist->total += value;
+	hist->max = max(hist->max, value);
 }
 
 /**
- * blkdev_trig_update_btb() - Update a BTB's activity counters and timestamps.
- * @btb:	The BTB
- * @now:	Timestamp (in jiffies)
+ * blkdev_trig_stats_begin() - Start recording statistics for a run of the
+ *	delayed work.
+ * @kicked:	Whether the run was kicked by an event
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Performs any requested reset of the statistics.
+ *
+ * Context:	Delayed work.
+ * Return:	Start time of the run (nanoseconds), or &0 if statistics are
+ *		disabled.
  */
-static void blkdev_trig_update_btb(struct blkdev_trig_bdev *btb,
-				   unsigned long now)
+static u64 blkdev_trig_stats_begin(bool kicked)
 {
-	unsigned long new_ios;
-	enum stat_group i;
+	u64 now_ns;
 
-	for (i = STAT_READ; i <= STAT_FLUSH; ++i) {
+	if (!READ_ONCE(blkdev_trig_stats_enabled))
+		return 0;
 
-		new_ios = part_stat_read(btb->bdev, ios[i]);
+	now_ns = ktime_get_ns();
 
-		if (new_ios != btb->ios[i]) {
-			btb->ios[i] = new_ios;
-			btb->last_activity[i] = now;
-		}
+	if (test_and_clear_bit(0, &blkdev_trig_stats_reset)) {
+		memset(&blkdev_trig_stats, 0, sizeof(blkdev_trig_stats));
+		blkdev_trig_stats.start_ns = now_ns;
 	}
 
-	btb->last_checked = now;
+	++blkdev_trig_stats.runs;
+	if (kicked)
+		++blkdev_trig_stats.kicked;
+
+	return now_ns;
 }
 
 /**
- * blkdev_trig_check() - Check linked devices for activity and blink LEDs.
- * @work:	Delayed work (&blkdev_trig_work)
+ * blkdev_trig_stats_late() - Record the lateness of a scheduled run of the
+ *	delayed work.
+ * @start:	Return value of blkdev_trig_stats_begin()
+ * @late:	Time by which the run started late
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Context:	Delayed work.
  */
-static void blkdev_trig_check(struct work_struct *work)
+static void blkdev_trig_stats_late(u64 start, ktime_t late)
 {
-	struct blkdev_trig_led *btl;
-	struct blkdev_trig_bdev *btb;
-	unsigned long index, delay, now, led_check, led_delay;
-	bool blinked;
+	if (start != 0)
+		blkdev_trig_hist_add(&blkdev_trig_stats.late_us,
+				     ktime_to_us(late));
+}
 
-	if (!mutex_trylock(&blkdev_trig_mutex)) {
-		delay = msecs_to_jiffies(BLKDEV_TRIG_CHECK_RETRY);
-		goto exit_reschedule;
-	}
+/**
+ * blkdev_trig_stats_end() - Finish recording statistics for a run of the
+ *	delayed work.
+ * @start:	Return value of blkdev_trig_stats_begin()
+ * @leds:	Number of LEDs checked
+ * @deferred:	Number of due LEDs deferred to another run
+ *
+ * Context:	Delayed work.
+ */
+static void blkdev_trig_stats_end(u64 start, unsigned int leds,
+				  unsigned int deferred)
+{
+	if (start == 0)
+		return;
 
-	now = jiffies;
-	delay = ULONG_MAX;
+	blkdev_trig_stats.leds += leds;
+	blkdev_trig_stats.deferred += deferred;
+	blkdev_trig_hist_add(&blkdev_trig_stats.tick_ns, ktime_get_ns() - start);
+}
 
-	hlist_for_each_entry (btl, &blkdev_trig_all_btls, all_btls_node) {
+/**
+ * blkdev_trig_stats_blinked() - Count a blink.
+ *
+ * Context:	Delayed work.
+ */
+static void blkdev_trig_stats_blinked(void)
+{
+	if (READ_ONCE(blkdev_trig_stats_enabled))
+		++blkdev_trig_stats.blinks;
+}
 
-		led_check = btl->last_checked + btl->check_jiffies;
+/**
+ * blkdev_trig_stats_read() - Count a read of a block device's counters.
+ *
+ * Context:	Any context.
+ */
+static void blkdev_trig_stats_read(void)
+{
+	if (READ_ONCE(blkdev_trig_stats_enabled))
+		atomic_long_inc(&blkdev_trig_stats.reads);
+}
 
-		if (time_before_eq(led_check, now)) {
+/**
+ * blkdev_trig_stats_skip() - Count a read of a block device's counters that was
+ *	skipped by a quick check.
+ *
+ * Context:	Any context.
+ */
+static void blkdev_trig_stats_skip(void)
+{
+	if (READ_ONCE(blkdev_trig_stats_enabled))
+		atomic_long_inc(&blkdev_trig_stats.skips);
+}
 
-			blinked = false;
+/**
+ * blkdev_trig_stats_event() - Record the time of an event, if no earlier event
+ *	is pending for the block device.
+ * @btb:	The BTB that represents the block device
+ *
+ * Context:	Any context.
+ */
+static void blkdev_trig_stats_event(struct blkdev_trig_bdev *btb)
+{
+	if (READ_ONCE(blkdev_trig_stats_enabled))
+		cmpxchg64(&btb->event_ns, 0, ktime_get_ns());
+}
 
-			xa_for_each (&btl->linked_btbs, index, btb) {
+/**
+ * blkdev_trig_stats_blink() - Record the latency of a blink in response to a
+ *	block device's pending events.
+ * @btb:	The BTB that represents the block device
+ * @blinked:	Whether any LEDs were blinked
+ *
+ * Context:	Delayed work.
+ */
+static void blkdev_trig_stats_blink(struct blkdev_trig_bdev *btb, bool blinked)
+{
+	u64 event_ns = xchg(&btb->event_ns, 0);
 
-				if (btb->last_checked != now)
-					blkdev_trig_update_btb(btb, now);
-				if (!blinked)
-					blinked = blkdev_trig_blink(btl, btb);
-			}
+	if (blinked && event_ns != 0 && READ_ONCE(blkdev_trig_stats_enabled))
+		blkdev_trig_hist_add(&blkdev_trig_stats.blink_us,
+				     div_u64(ktime_get_ns() - event_ns,
+					     NSEC_PER_USEC));
+}
 
-			btl->last_checked = now;
-			led_delay = btl->check_jiffies;
+#else	/* CONFIG_DEBUG_FS */
 
-		} else {
-			led_delay = led_check - now;
-		}
+static u64 blkdev_trig_stats_begin(bool kicked)
+{
+	return 0;
+}
 
-		if (led_delay < delay)
-			delay = led_delay;
-	}
+static void blkdev_trig_stats_late(u64 start, ktime_t late)
+{
+}
 
-	mutex_unlock(&blkdev_trig_mutex);
+static void blkdev_trig_stats_blinked(void)
+{
+}
 
-exit_reschedule:
-	WARN_ON_ONCE(delay == ULONG_MAX);
-	WARN_ON_ONCE(!schedule_delayed_work(&blkdev_trig_work, delay));
+static void blkdev_trig_stats_end(u64 start, unsigned int leds,
+				  unsigned int deferred)
+{
 }
 
-/**
- * blkdev_trig_sched_led() - Set the schedule of the delayed work when a new
- *	LED is added to the schedule.
- * @btl:	The BTL that represents the LED
- *
- * Called when the number of block devices to which an LED is linked becomes
- * non-zero.
- *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
- */
-static void blkdev_trig_sched_led(const struct blkdev_trig_led *btl)
+static void blkdev_trig_stats_read(void)
 {
-	unsigned long delay = READ_ONCE(btl->check_jiffies);
-	unsigned long check_by = jiffies + delay;
+}
 
-	/*
-	 * If no other LED-to-block device links exist, simply schedule the
-	 * delayed work according to this LED's check_interval attribute
-	 * (check_jiffies).
-	 */
-	if (blkdev_trig_link_count == 0) {
-		WARN_ON(!schedule_delayed_work(&blkdev_trig_work, delay));
-		blkdev_trig_next_check = check_by;
-		return;
-	}
+static void blkdev_trig_stats_skip(void)
+{
+}
 
-	/*
-	 * If the next check is already scheduled to occur soon enough to
-	 * accomodate this LED's check_interval, the schedule doesn't need
-	 * to be changed.
-	 */
-	if (time_after_eq(check_by, blkdev_trig_next_check))
-		return;
+static void blkdev_trig_stats_event(struct blkdev_trig_bdev *btb)
+{
+}
 
-	/*
-	 * Modify the schedule, so that the delayed work runs soon enough for
-	 * this LED.
-	 */
-	WARN_ON(!mod_delayed_work(system_wq, &blkdev_trig_work, delay));
-	blkdev_trig_next_check = check_by;
+static void blkdev_trig_stats_blink(struct blkdev_trig_bdev *btb, bool blinked)
+{
 }
 
+#endif	/* CONFIG_DEBUG_FS */
+
 
 /*
  *
- *	Linking and unlinking LEDs and block devices
+ *	Batched LED updates
  *
  */
 
+/* Maximum number of blinks passed to a batch callback at once */
+#define BLKDEV_TRIG_BATCH_MAX	32
+
+/* The registered batch callbacks, if any (protected by blkdev_trig_mutex) */
+static const struct blkdev_trig_batch __rcu *blkdev_trig_batch;
+
+/* Batch callbacks (and blinks collected) for the current run of the work */
+static const struct blkdev_trig_batch *blkdev_trig_cur_batch;
+static struct blkdev_trig_blink blkdev_trig_blinks[BLKDEV_TRIG_BATCH_MAX];
+static unsigned int blkdev_trig_nr_blinks;
+
 /**
- * blkdev_trig_link() - Link a block device to an LED.
- * @btl:	The BTL that represents the LED
- * @btb:	The BTB that represents the block device
+ * blkdev_trig_batch_register() - Register callbacks for batched blinks.
+ * @batch:	The callbacks
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
- * Return:	&0 on success, negative &errno on error.
+ * Only one set of callbacks can be registered at a time.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&0 on success, &-EBUSY if callbacks are already registered.
  */
-static int blkdev_trig_link(struct blkdev_trig_led *btl,
-			    struct blkdev_trig_bdev *btb)
+int blkdev_trig_batch_register(const struct blkdev_trig_batch *batch)
 {
-	bool led_first_link;
-	int err;
-
-	led_first_link = xa_empty(&btl->linked_btbs);
-
-	err = xa_insert(&btb->linked_btls, btl->index, btl, GFP_KERNEL);
-	if (err)
-		return err;
-
-	err = xa_insert(&btl->linked_btbs, btb->index, btb, GFP_KERNEL);
-	if (err)
-		goto error_erase_btl;
-
-	/* Create /sys/class/block/<bdev>/linked_leds/<led> symlink */
-	err = sysfs_add_link_to_group(bdev_kobj(btb->bdev),
-				      blkdev_trig_linked_leds.name,
-				      &btl->led->dev->kobj, btl->led->name);
-	if (err)
-		goto error_erase_btb;
-
-	/* Create /sys/class/leds/<led>/linked_devices/<bdev> symlink */
-	err = sysfs_add_link_to_group(&btl->led->dev->kobj,
-				      blkdev_trig_linked_devs.name,
-				      bdev_kobj(btb->bdev),
-				      dev_name(&btb->bdev->bd_device));
-	if (err)
-		goto error_remove_symlink;
-
-	/*
-	 * If this is the first block device linked to this LED, the delayed
-	 * work schedule may need to be changed.
-	 */
-	if (led_first_link)
-		blkdev_trig_sched_led(btl);
+	int err = 0;
 
-	++blkdev_trig_link_count;
+	mutex_lock(&blkdev_trig_mutex);
 
-	return 0;
+	if (rcu_access_pointer(blkdev_trig_batch) != NULL)
+		err = -EBUSY;
+	else
+		rcu_assign_pointer(blkdev_trig_batch, batch);
 
-error_remove_symlink:
-	sysfs_remove_link_from_group(bdev_kobj(btb->bdev),
-				     blkdev_trig_linked_leds.name,
-				     btl->led->name);
-error_erase_btb:
-	xa_erase(&btl->linked_btbs, btb->index);
-error_erase_btl:
-	xa_erase(&btb->linked_btls, btl->index);
+	mutex_unlock(&blkdev_trig_mutex);
 	return err;
 }
+EXPORT_SYMBOL_GPL(blkdev_trig_batch_register);
 
 /**
- * blkdev_trig_put_btb() - Remove and free a BTB, if it is no longer needed.
- * @btb:	The BTB
+ * blkdev_trig_batch_unregister() - Unregister callbacks for batched blinks.
+ * @batch:	The callbacks
  *
- * Does nothing if the BTB (block device) is still linked to at least one LED.
+ * When this function returns, the callbacks are no longer in use.
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
  */
-static void blkdev_trig_put_btb(struct blkdev_trig_bdev *btb)
+void blkdev_trig_batch_unregister(const struct blkdev_trig_batch *batch)
 {
-	struct block_device *bdev = btb->bdev;
-	int err;
+	mutex_lock(&blkdev_trig_mutex);
 
-	if (xa_empty(&btb->linked_btls)) {
+	if (rcu_access_pointer(blkdev_trig_batch) == batch)
+		RCU_INIT_POINTER(blkdev_trig_batch, NULL);
 
-		sysfs_remove_group(bdev_kobj(bdev), &blkdev_trig_linked_leds);
-		err = devres_destroy(&bdev->bd_device, blkdev_trig_btb_release,
-				     NULL, NULL);
-		WARN_ON(err);
-	}
+	mutex_unlock(&blkdev_trig_mutex);
+
+	/* Wait for any run of the delayed work that might still use them */
+	synchronize_rcu();
 }
+EXPORT_SYMBOL_GPL(blkdev_trig_batch_unregister);
 
 /**
- * _blkdev_trig_unlink_always() - Perform the unconditionally required steps of
- *	unlinking a block device from an LED.
- * @btl:	The BTL that represents the LED
- * @btb:	The BTB that represents the block device
+ * blkdev_trig_batch_flush() - Pass the collected blinks to the batch callback.
  *
- * When a block device is unlinked from an LED, certain steps must be performed
- * only if the block device is **not** being released.  This function performs
- * those steps that are **always** required, whether or not the block device is
- * being released.
+ * Context:	Delayed work.  Caller must hold the RCU read lock.
+ */
+static void blkdev_trig_batch_flush(void)
+{
+	if (blkdev_trig_nr_blinks == 0)
+		return;
+
+	blkdev_trig_cur_batch->blink(blkdev_trig_blinks, blkdev_trig_nr_blinks);
+	blkdev_trig_nr_blinks = 0;
+}
+
+/**
+ * blkdev_trig_batch_add() - Add a blink to the current batch.
+ * @led:	The LED
+ * @delay_on:	Duration of the blink (milliseconds)
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Context:	Delayed work.  Caller must hold the RCU read lock.
+ * Return:	&true if the blink was added, &false if the LED must be blinked
+ *		individually.
  */
-static void _blkdev_trig_unlink_always(struct blkdev_trig_led *btl,
-				       struct blkdev_trig_bdev *btb)
+static bool blkdev_trig_batch_add(struct led_classdev *led,
+				  unsigned long delay_on)
 {
-	--blkdev_trig_link_count;
+	const struct blkdev_trig_batch *batch = blkdev_trig_cur_batch;
 
-	if (blkdev_trig_link_count == 0)
-		WARN_ON(!cancel_delayed_work_sync(&blkdev_trig_work));
+	if (batch == NULL || !batch->owns(led))
+		return false;
 
-	xa_erase(&btb->linked_btls, btl->index);
-	xa_erase(&btl->linked_btbs, btb->index);
+	if (blkdev_trig_nr_blinks == BLKDEV_TRIG_BATCH_MAX)
+		blkdev_trig_batch_flush();
 
-	/* Remove /sys/class/leds/<led>/linked_devices/<bdev> symlink */
-	sysfs_remove_link_from_group(&btl->led->dev->kobj,
-				     blkdev_trig_linked_devs.name,
-				     dev_name(&btb->bdev->bd_device));
+	blkdev_trig_blinks[blkdev_trig_nr_blinks].led = led;
+	blkdev_trig_blinks[blkdev_trig_nr_blinks].delay_on = delay_on;
+	++blkdev_trig_nr_blinks;
+
+	return true;
 }
 
+
+/*
+ *
+ *	Delayed work to check for activity & blink LEDs
+ *
+ */
+
 /**
- * blkdev_trig_unlink_norelease() - Unlink an LED from a block device that is
- *	**not** being released.
- * @btl:	The BTL that represents the LED.
- * @btb:	The BTB that represents the block device.
+ * blkdev_trig_oneshot() - Blink an LED once for a given duration.
+ * @btl:	The BTL that represents the LED
+ * @delay_on:	Duration of the blink (milliseconds)
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * If the LED's driver has registered batch callbacks that handle the LED, the
+ * blink is added to the current batch instead.
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.
  */
-static void blkdev_trig_unlink_norelease(struct blkdev_trig_led *btl,
-					 struct blkdev_trig_bdev *btb)
+static void blkdev_trig_oneshot(const struct blkdev_trig_led *btl,
+				unsigned long delay_on)
 {
-	_blkdev_trig_unlink_always(btl, btb);
+	unsigned long delay_off = 1;	/* 0 leaves LED turned on */
 
-	/* Remove /sys/class/block/<bdev>/linked_leds/<led> symlink */
-	sysfs_remove_link_from_group(bdev_kobj(btb->bdev),
-				     blkdev_trig_linked_leds.name,
-				     btl->led->name);
+	trace_blkdev_trig_blink(btl->led, delay_on);
+	blkdev_trig_stats_blinked();
 
-	blkdev_trig_put_btb(btb);
+	if (!blkdev_trig_batch_add(btl->led, delay_on))
+		led_blink_set_oneshot(btl->led, &delay_on, &delay_off, 0);
 }
 
 /**
- * blkdev_trig_unlink_release() - Unlink an LED from a block device that is
- *	being released.
+ * blkdev_trig_blink_led() - Blink an LED once.
  * @btl:	The BTL that represents the LED
- * @btb:	The BTB that represents the block device
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Context:	Process context.  Caller must hold the RCU read lock.
  */
-static void blkdev_trig_unlink_release(struct blkdev_trig_led *btl,
-				       struct blkdev_trig_bdev *btb)
+static void blkdev_trig_blink_led(const struct blkdev_trig_led *btl)
 {
-	_blkdev_trig_unlink_always(btl, btb);
-
-	/*
-	 * If the BTB is being released, the driver core has already removed the
-	 * device's attribute groups, and the BTB will be freed automatically,
-	 * so there's nothing else to do.
-	 */
+	blkdev_trig_oneshot(btl, READ_ONCE(btl->blink_msec));
 }
 
-
-/*
+/**
+ * blkdev_trig_read_ios() - Read all of a block device's I/O counters.
+ * @bdev:	The block device
+ * @ios:	Output array of operation counts, indexed by &enum stat_group
+ * @sectors:	Output array of sector counts, indexed by &enum stat_group
  *
- *	BTB creation
+ * Equivalent to calling part_stat_read() for each stat group, but walks the
+ * per-CPU statistics only once.
  *
+ * Context:	Any context.
  */
+static void blkdev_trig_read_ios(struct block_device *bdev,
+				 unsigned long ios[NR_STAT_GROUPS],
+				 unsigned long sectors[NR_STAT_GROUPS])
+{
+	const struct disk_stats *stats;
+	enum stat_group i;
+	int cpu;
+
+	blkdev_trig_stats_read();
+
+	memset(ios, 0, NR_STAT_GROUPS * sizeof(*ios));
+	memset(sectors, 0, NR_STAT_GROUPS * sizeof(*sectors));
+
+	for_each_possible_cpu(cpu) {
+
+		stats = per_cpu_ptr(bdev->bd_stats, cpu);
+
+		for (i = STAT_READ; i <= STAT_FLUSH; ++i) {
+			ios[i] += stats->ios[i];
+			sectors[i] += stats->sectors[i];
+		}
+	}
+}
 
 /**
- * blkdev_trig_btb_release() - BTB device resource release function.
- * @dev:	The block device
- * @res:	The BTB
+ * blkdev_trig_quick_idle() - Check whether a block device has been idle since
+ *	its counters were last read, without reading them.
+ * @btb:	The BTB that represents the block device
  *
- * Called by the driver core when a block device with a BTB is removed.
+ * The block layer updates a device's &bd_stamp (the jiffy of its most recent
+ * I/O accounting, which also covers I/O to its partitions) when an I/O starts
+ * or completes in a later jiffy than the previous one.  So if &bd_stamp hasn't
+ * changed since a jiffy that had already ended when the counters were read,
+ * no I/O has been accounted since.
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Flushes update &blkdev_trig_bdev.ios (&STAT_FLUSH) but not &bd_stamp, so
+ * for LEDs that blink on flushes, the flush counter of an idle device is still
+ * read (see blkdev_trig_update_flush()).
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.
+ * Return:	&true if the block device has been idle.
  */
-static void blkdev_trig_btb_release(struct device *dev, void *res)
+static bool blkdev_trig_quick_idle(const struct blkdev_trig_bdev *btb)
 {
-	struct blkdev_trig_bdev *btb = res;
-	struct blkdev_trig_led *btl;
-	unsigned long index;
-
-	mutex_lock(&blkdev_trig_mutex);
+	return READ_ONCE(btb->bdev->bd_stamp) == btb->stamp;
+}
 
-	xa_for_each (&btb->linked_btls, index, btl)
-		blkdev_trig_unlink_release(btl, btb);
+/**
+ * blkdev_trig_standby() - Check whether a block device is runtime-suspended.
+ * @btb:	The BTB that represents the block device
+ *
+ * A disk's runtime PM state is kept by its parent device (e.g. its SCSI
+ * device), not by the gendisk.  Stacked devices (which have no parent) are
+ * never considered to be suspended.
+ *
+ * Context:	Any context.
+ * Return:	&true if the block device is runtime-suspended.
+ */
+static bool blkdev_trig_standby(const struct blkdev_trig_bdev *btb)
+{
+	struct device *parent = disk_to_dev(btb->bdev->bd_disk)->parent;
 
-	mutex_unlock(&blkdev_trig_mutex);
+	return parent != NULL && pm_runtime_suspended(parent);
 }
 
 /**
- * blkdev_trig_get_bdev() - Get a block device by path.
- * @path:	The value written to an LED's &link_dev_by_path or
- *		&unlink_dev_by_path attribute, which should be the path to a
- *		special file that represents a block device
- * @len:	The number of characters in &path (not including its
- *		terminating null)
+ * blkdev_trig_update_flush() - Update only a BTB's flush counter.
+ * @btb:	The BTB
+ * @now:	Timestamp
  *
- * The caller must call blkdev_put() when finished with the device.
+ * Used by quick checks of idle block devices for LEDs that blink on flushes,
+ * which don't update &bd_stamp.  Flushes transfer no sectors, so only
+ * &blkdev_trig_bdev.ios is updated.
  *
- * Context:	Process context.
- * Return:	The block device, or an error pointer.
+ * Context:	Process context.  Caller must hold the RCU read lock.
  */
-static struct block_device *blkdev_trig_get_bdev(const char *path, size_t len)
+static void blkdev_trig_update_flush(struct blkdev_trig_bdev *btb, ktime_t now)
 {
-	struct block_device *bdev;
-	char *buf;
+	unsigned long ios = part_stat_read(btb->bdev, ios[STAT_FLUSH]);
 
-	buf = kmemdup(path, len + 1, GFP_KERNEL);  /* +1 to include null */
-	if (buf == NULL)
-		return ERR_PTR(-ENOMEM);
+	if (ios != btb->ios[STAT_FLUSH]) {
+		btb->ios[STAT_FLUSH] = ios;
+		btb->last_activity[STAT_FLUSH] = now;
+		btb->last_any = now;
+	}
 
-	bdev = blkdev_get_by_path(strim(buf), BLK_OPEN_READ, THIS_MODULE, NULL);
-	kfree(buf);
-	return bdev;
+	btb->last_flush = now;
 }
 
 /**
- * blkdev_trig_get_btb() - Find or create the BTB for a block device.
- * @path:	The value written to an LED's &link_dev_by_path attribute,
- *		which should be the path to a special file that represents a
- *		block device
- * @len:	The number of characters in &path
+ * blkdev_trig_update_btb() - Update a BTB's activity counters and timestamps.
+ * @btb:	The BTB
+ * @now:	Timestamp
+ * @quick:	Whether the counters may be left unread if blkdev_trig_quick_idle()
+ *		shows that the block device has been idle
+ * @flush:	Whether the flush counter must be read even if the others are
+ *		left unread by a quick check
  *
- * If a new BTB is created, because the block device was not previously linked
- * to any LEDs, the block device's &linked_leds &sysfs directory is created.
+ * If &blkdev_trig_skip_suspended is set, the counters of a runtime-suspended
+ * block device are also left unread, whether or not &quick is set.
  *
- * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
- * Return:	Pointer to the BTB, error pointer on error.
+ * Context:	Process context.  Caller must hold the RCU read lock (or the
+ *		BTB must not yet be linked to any LED).
  */
-static struct blkdev_trig_bdev *blkdev_trig_get_btb(const char *path,
-						    size_t len)
+static void blkdev_trig_update_btb(struct blkdev_trig_bdev *btb, ktime_t now,
+				   bool quick, bool flush)
 {
-	struct block_device *bdev;
-	struct blkdev_trig_bdev *btb;
-	int err;
+	unsigned long new_ios[NR_STAT_GROUPS], new_sectors[NR_STAT_GROUPS];
+	unsigned long changed = 0, stamp;
+	enum stat_group i;
 
-	bdev = blkdev_trig_get_bdev(path, len);
-	if (IS_ERR(bdev))
-		return ERR_CAST(bdev);
+	btb->last_checked = now;
 
-	btb = devres_find(&bdev->bd_device, blkdev_trig_btb_release,
-			  NULL, NULL);
-	if (btb != NULL) {
-		err = 0;
-		goto exit_put_bdev;
+	if (READ_ONCE(blkdev_trig_skip_suspended) && blkdev_trig_standby(btb)) {
+		blkdev_trig_stats_skip();
+		return;
 	}
 
-	if (blkdev_trig_next_index == ULONG_MAX) {
-		err = -EOVERFLOW;
-		goto exit_put_bdev;
+	if (quick && blkdev_trig_quick_idle(btb)) {
+		if (flush)
+			blkdev_trig_update_flush(btb, now);
+		blkdev_trig_stats_skip();
+		return;
 	}
 
-	btb = devres_alloc(blkdev_trig_btb_release, sizeof(*btb), GFP_KERNEL);
-	if (btb == NULL) {
-		err = -ENOMEM;
-		goto exit_put_bdev;
-	}
+	/* Read the stamp first; any later I/O will change it (or the counters) */
+	stamp = READ_ONCE(btb->bdev->bd_stamp);
+	smp_rmb();
 
-	err = sysfs_create_group(bdev_kobj(bdev), &blkdev_trig_linked_leds);
-	if (err)
-		goto exit_free_btb;
+	/*
+	 * An I/O accounted later in the current jiffy won't change the stamp,
+	 * so the stamp can't be trusted until the jiffy has ended.  The stamp
+	 * only moves forward, so stamp - 1 never matches.
+	 */
+	btb->stamp = time_before(stamp, jiffies) ? stamp : stamp - 1;
 
-	btb->index = blkdev_trig_next_index++;
-	btb->bdev = bdev;
-	xa_init(&btb->linked_btls);
+	blkdev_trig_read_ios(btb->bdev, new_ios, new_sectors);
 
-	/* Populate BTB activity counters */
-	blkdev_trig_update_btb(btb, jiffies);
+	for (i = STAT_READ; i <= STAT_FLUSH; ++i) {
 
-	devres_add(&bdev->bd_device, btb);
+		if (new_ios[i] != btb->ios[i]) {
+			btb->ios[i] = new_ios[i];
+			btb->last_activity[i] = now;
+			btb->last_any = now;
+			changed |= 1 << i;
+		}
+	}
 
-exit_free_btb:
-	if (err)
-		devres_free(btb);
-exit_put_bdev:
-	blkdev_put(bdev, THIS_MODULE);
-	return err ? ERR_PTR(err) : btb;
-}
+	/* Sectors are only used after activity; don't touch them otherwise */
+	if (changed)
+		memcpy(btb->sectors, new_sectors, sizeof(btb->sectors));
 
+	btb->last_full = now;
+	btb->last_flush = now;
 
-/*
- *
- *	Activating and deactivating the trigger on an LED
- *
- */
+	trace_blkdev_trig_update_btb(btb->bdev->bd_dev, new_ios, changed);
+}
 
 /**
- * blkdev_trig_activate() - Called by the LEDs subsystem when an LED is
- *	associated with the trigger.
- * @led:	The LED
+ * blkdev_trig_btb_activity() - Get the types of activity that have occurred on
+ *	a block device since a given time.
+ * @btb:	The BTB that represents the block device
+ * @since:	Timestamp
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
- * Return:	&0 on success, negative &errno on error.
+ * Context:	Process context.  Caller must hold the RCU read lock.
+ * Return:	Bitmask of activity types (one bit per &enum stat_group, in the
+ *		same format as &blkdev_trig_led.mode).
  */
-static int blkdev_trig_activate(struct led_classdev *led)
+static unsigned long blkdev_trig_btb_activity(const struct blkdev_trig_bdev *btb,
+					      ktime_t since)
 {
-	struct blkdev_trig_led *btl;
-	int err;
+	unsigned long activity;
+	enum stat_group i;
 
-	btl = kzalloc(sizeof(*btl), GFP_KERNEL);
-	if (btl == NULL)
-		return -ENOMEM;
+	/* Most block devices are idle most of the time */
+	if (ktime_compare(btb->last_any, since) <= 0)
+		return 0;
 
-	err = mutex_lock_interruptible(&blkdev_trig_mutex);
-	if (err)
-		goto exit_free;
+	activity = 0;
 
-	if (blkdev_trig_next_index == ULONG_MAX) {
-		err = -EOVERFLOW;
-		goto exit_unlock;
+	for (i = STAT_READ; i <= STAT_FLUSH; ++i) {
+		if (ktime_after(btb->last_activity[i], since))
+			activity |= 1 << i;
 	}
 
-	btl->index = blkdev_trig_next_index++;
-	btl->last_checked = jiffies;
-	btl->mode = -1;  /* set all bits */
-	btl->led = led;
-	btl->blink_msec = BLKDEV_TRIG_BLINK_DEF;
-	btl->check_jiffies = msecs_to_jiffies(BLKDEV_TRIG_CHECK_DEF);
-	xa_init(&btl->linked_btbs);
+	return activity;
+}
 
-	hlist_add_head(&btl->all_btls_node, &blkdev_trig_all_btls);
-	led_set_trigger_data(led, btl);
+/**
+ * blkdev_trig_backoff() - Update an LED's check interval after a check.
+ * @btl:	The BTL that represents the LED
+ * @active:	Whether the check found activity on any of the LED's block
+ *		devices
+ *
+ * After &BLKDEV_TRIG_IDLE_CHECKS consecutive checks with no activity, the
+ * interval between checks is doubled after each additional idle check, up to
+ * &blkdev_trig_led.max_interval.  The interval snaps back to
+ * &blkdev_trig_led.check_interval as soon as activity is detected.
+ *
+ * &blkdev_trig_led.cur_interval and &blkdev_trig_led.idle_checks are also reset
+ * by blkdev_trig_sched_led(), so both are only changed under
+ * &blkdev_trig_sched_lock.
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.  Takes and
+ *		releases &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_backoff(struct blkdev_trig_led *btl, bool active)
+{
+	ktime_t check = READ_ONCE(btl->check_interval);
+	ktime_t max = READ_ONCE(btl->max_interval);
+
+	spin_lock(&blkdev_trig_sched_lock);
+
+	if (active || max <= check) {
+		btl->idle_checks = 0;
+		btl->cur_interval = check;
+	} else if (btl->idle_checks < BLKDEV_TRIG_IDLE_CHECKS) {
+		++btl->idle_checks;
+		btl->cur_interval = check;
+	} else {
+		btl->cur_interval = clamp(btl->cur_interval * 2, check, max);
+	}
 
-exit_unlock:
-	mutex_unlock(&blkdev_trig_mutex);
-exit_free:
-	if (err)
-		kfree(btl);
-	return err;
+	spin_unlock(&blkdev_trig_sched_lock);
 }
 
 /**
- * blkdev_trig_deactivate() - Called by the the LEDs subsystem when an LED is
- *	disassociated from the trigger.
- * @led:	The LED
+ * blkdev_trig_update_led_btbs() - Update the BTBs of the block devices linked
+ *	to an LED.
+ * @btl:	The BTL that represents the LED
+ * @now:	Timestamp
  *
- * The LEDs subsystem also calls this function when an LED associated with the
- * trigger is removed or when the trigger is unregistered (if the module is
- * unloaded).
+ * BTBs that have already been updated during this run of the delayed work
+ * (because they are also linked to another LED that is due) are not updated
+ * again, unless this LED needs counters that a quick check didn't read.  Quick
+ * checks stay enabled for LEDs that blink on flushes; only the flush counter of
+ * an idle block device is read for them.
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Context:	Process context.  Caller must hold the RCU read lock.
  */
-static void blkdev_trig_deactivate(struct led_classdev *led)
+static void blkdev_trig_update_led_btbs(const struct blkdev_trig_led *btl,
+					ktime_t now)
 {
-	struct blkdev_trig_led *btl = led_get_trigger_data(led);
 	struct blkdev_trig_bdev *btb;
 	unsigned long index;
+	bool quick, flush;
 
-	mutex_lock(&blkdev_trig_mutex);
-
-	xa_for_each (&btl->linked_btbs, index, btb)
-		blkdev_trig_unlink_norelease(btl, btb);
-
-	hlist_del(&btl->all_btls_node);
-	kfree(btl);
+	quick = READ_ONCE(blkdev_trig_quick_check);
+	flush = READ_ONCE(btl->mode) & (1 << STAT_FLUSH);
 
-	mutex_unlock(&blkdev_trig_mutex);
+	xa_for_each (&btl->linked_btbs, index, btb) {
+		if (!ktime_equal(btb->last_checked, now) ||
+		    (!quick && !ktime_equal(btb->last_full, now)) ||
+		    (flush && !ktime_equal(btb->last_flush, now)))
+			blkdev_trig_update_btb(btb, now, quick, flush);
+	}
 }
 
-
-/*
- *
- *	Link-related attribute store functions
- *
- */
-
 /**
- * link_dev_by_path_store() - &link_dev_by_path device attribute store function.
- * @dev:	The LED device
- * @attr:	The &link_dev_by_path attribute (&dev_attr_link_dev_by_path)
- * @buf:	The value written to the attribute, which should be the path to
- *		a special file that represents a block device to be linked to
- *		the LED (e.g. ``/dev/sda``)
- * @count:	The number of characters in &buf
+ * blkdev_trig_snapshot() - Sum the counters of an LED's block devices.
+ * @btl:	The BTL that represents the LED
+ * @ios:	Output - the sum of the activity counters (of the types selected
+ *		by &blkdev_trig_led.mode)
+ * @sectors:	Output - the sum of the sector counters
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
- * Return:	&count on success, negative &errno on error.
+ * The caller must store the sums in &blkdev_trig_led.snap_ios and
+ * &blkdev_trig_led.snap_sectors, for comparison by the next check.
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.
+ * Return:	&true if the sums can be compared with the previous snapshot,
+ *		&false if the LED's links or mode have changed since it was taken.
  */
-static ssize_t link_dev_by_path_store(struct device *dev,
-				      struct device_attribute *attr,
-				      const char *buf, size_t count)
+static bool blkdev_trig_snapshot(struct blkdev_trig_led *btl,
+				 unsigned long *ios, unsigned long *sectors)
 {
-	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned long index, mode;
 	struct blkdev_trig_bdev *btb;
-	int err;
+	enum stat_group i;
+	unsigned int gen;
 
-	err = mutex_lock_interruptible(&blkdev_trig_mutex);
-	if (err)
-		return err;
+	mode = READ_ONCE(btl->mode);
+	gen = READ_ONCE(btl->link_gen);
+	*ios = 0;
+	*sectors = 0;
 
-	btb = blkdev_trig_get_btb(buf, count);
-	if (IS_ERR(btb)) {
-		err = PTR_ERR(btb);
-		goto exit_unlock;
+	xa_for_each (&btl->linked_btbs, index, btb) {
+		for (i = STAT_READ; i <= STAT_FLUSH; ++i) {
+			if (mode & (1 << i)) {
+				*ios += btb->ios[i];
+				*sectors += btb->sectors[i];
+			}
+		}
 	}
 
-	if (xa_load(&btb->linked_btls, btl->index) != NULL) {
-		err = -EEXIST;
-		goto exit_put_btb;
+	/* If the links or mode have changed, the sums aren't comparable */
+	if (gen != btl->snap_gen || mode != btl->snap_mode) {
+		btl->snap_gen = gen;
+		btl->snap_mode = mode;
+		return false;
 	}
 
-	err = blkdev_trig_link(btl, btb);
-
-exit_put_btb:
-	if (err)
-		blkdev_trig_put_btb(btb);
-exit_unlock:
-	mutex_unlock(&blkdev_trig_mutex);
-	return err ? : count;
+	return true;
 }
 
 /**
- * unlink_dev_by_path_store() - &unlink_dev_by_path device attribute store
- *	function.
- * @dev:	The LED device
- * @attr:	The &unlink_dev_by_path attribute (&dev_attr_unlink_dev_by_path)
- * @buf:	The value written to the attribute, which should be the path to
- *		a special file that represents a block device to be unlinked
- *		from the LED (e.g. ``/dev/sda``)
- * @count:	The number of characters in &buf
+ * blkdev_trig_threshold() - Check whether the activity of an LED's block
+ *	devices since the last check meets the LED's thresholds.
+ * @btl:	The BTL that represents the LED
+ * @now:	Timestamp
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
- * Return:	&count on success, negative &errno on error.
+ * Only called when the check has found activity (of a type selected by
+ * &blkdev_trig_led.mode).  Each non-zero threshold (&blkdev_trig_led.min_ios
+ * and &blkdev_trig_led.min_sectors) must be met by the combined activity of
+ * all of the LED's block devices.
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.
+ * Return:	&true if the LED should blink.
  */
-static ssize_t unlink_dev_by_path_store(struct device *dev,
-					struct device_attribute *attr,
-					const char *buf, size_t count)
+static bool blkdev_trig_threshold(struct blkdev_trig_led *btl, ktime_t now)
 {
-	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
-	struct block_device *bdev;
-	struct blkdev_trig_bdev *btb;
-	int err;
-
-	bdev = blkdev_trig_get_bdev(buf, count);
-	if (IS_ERR(bdev))
-		return PTR_ERR(bdev);
+	unsigned int min_ios = READ_ONCE(btl->min_ios);
+	unsigned int min_sectors = READ_ONCE(btl->min_sectors);
+	unsigned long ios, sectors;
+	bool blink;
 
-	err = mutex_lock_interruptible(&blkdev_trig_mutex);
-	if (err)
-		goto exit_put_bdev;
+	if (min_ios == 0 && min_sectors == 0)
+		return true;
 
-	btb = devres_find(&bdev->bd_device, blkdev_trig_btb_release,
-			  NULL, NULL);
-	if (btb == NULL) {
-		err = -EUNATCH;  /* bdev isn't linked to any LED */
-		goto exit_unlock;
-	}
+	blink = blkdev_trig_snapshot(btl, &ios, &sectors) &&
+		ios - btl->snap_ios >= min_ios &&
+		sectors - btl->snap_sectors >= min_sectors;
 
-	if (xa_load(&btb->linked_btls, btl->index) == NULL) {
-		err = -EUNATCH;  /* bdev isn't linked to this LED */
-		goto exit_unlock;
-	}
+	btl->snap_ios = ios;
+	btl->snap_sectors = sectors;
+	btl->snap_time = now;
 
-	blkdev_trig_unlink_norelease(btl, btb);
+	return blink;
+}
+
+/**
+ * blkdev_trig_intensity() - Show the I/O rate of an LED's block devices.
+ * @btl:	The BTL that represents the LED
+ * @now:	Timestamp
+ *
+ * Computes the combined rate (operations per second, of the types selected by
+ * &blkdev_trig_led.mode) of all of the LED's block devices since the LED was
+ * last checked, relative to &blkdev_trig_led.intensity_full.  An LED that
+ * supports multiple brightness levels (e.g. a PWM-driven LED) is set to a
+ * proportional brightness.  An on/off LED is blinked for a proportional
+ * fraction of the check interval.
+ *
+ * Brightness is only independent per LED if the LED's driver gives each LED
+ * its own PWM channel.  Some dimmers (e.g. the PCA9532) drive every dimmed LED
+ * from one shared PWM channel, so each LED set to a partial brightness changes
+ * the brightness of all of them; on such hardware, all of the dimmed LEDs show
+ * the rate of whichever LED was checked last.
+ *
+ * &blkdev_trig_led.intensity_level is also cleared (with the LED turned off)
+ * by intensity_mode_store(), so it is accessed with READ_ONCE() and
+ * WRITE_ONCE().
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.
+ */
+static void blkdev_trig_intensity(struct blkdev_trig_led *btl, ktime_t now)
+{
+	unsigned long sum, sectors, delay_on;
+	unsigned int full, max_level, level;
+	u64 rate, elapsed;
+
+	if (!blkdev_trig_snapshot(btl, &sum, &sectors))
+		goto exit_snapshot;
+
+	elapsed = ktime_to_ns(ktime_sub(now, btl->snap_time));
+	if (elapsed == 0)
+		goto exit_snapshot;
+
+	full = READ_ONCE(btl->intensity_full);
+	rate = div64_u64((u64)(sum - btl->snap_ios) * NSEC_PER_SEC, elapsed);
+	rate = min_t(u64, rate, full);
+
+	max_level = btl->led->max_brightness;
+
+	if (max_level > 1) {
+		level = DIV_ROUND_UP_ULL(rate * max_level, full);
+		if (level != READ_ONCE(btl->intensity_level)) {
+			led_set_brightness(btl->led, level);
+			WRITE_ONCE(btl->intensity_level, level);
+		}
+	} else if (rate > 0) {
+		delay_on = div_u64(rate * div_u64(elapsed, NSEC_PER_MSEC), full);
+		delay_on = max(delay_on, (unsigned long)BLKDEV_TRIG_BLINK_MIN);
+		blkdev_trig_oneshot(btl, delay_on);
+	}
+
+exit_snapshot:
+	btl->snap_ios = sum;
+	btl->snap_sectors = sectors;
+	btl->snap_time = now;
+}
+
+/**
+ * blkdev_trig_hw_blink() - Start or stop hardware blinking of an LED.
+ * @btl:	The BTL that represents the LED
+ * @blink:	Whether the current check wants the LED to blink
+ *
+ * If &blkdev_trig_led.hw_blink is set and the LED's driver supports hardware
+ * blinking, an LED that has blinked for &BLKDEV_TRIG_HW_BLINK_CHECKS
+ * consecutive checks is left blinking at the driver's default rate, until a
+ * check finds no activity.  This avoids a software timer callback (and a write
+ * to the LED hardware) for every blink of a busy disk.
+ *
+ * Drivers whose &blink_set may sleep (e.g. I2C LED controllers, which also set
+ * &brightness_set_blocking) are called from the LED core's workqueue, via
+ * led_blink_set_nosleep().  Stopping the blink with led_set_brightness() is
+ * deferred in the same way.
+ *
+ * Context:	Caller must hold the RCU read lock, so this function must not
+ *		sleep.
+ * Return:	&true if the LED is blinking in hardware (so a software blink is
+ *		not needed).
+ */
+static bool blkdev_trig_hw_blink(struct blkdev_trig_led *btl, bool blink)
+{
+	if (!blink || !READ_ONCE(btl->hw_blink)) {
+		btl->busy_checks = 0;
+		if (btl->hw_blinking) {
+			led_set_brightness(btl->led, LED_OFF);
+			btl->hw_blinking = false;
+		}
+		return false;
+	}
+
+	if (btl->hw_blinking)
+		return true;
+
+	if (btl->led->blink_set == NULL ||
+	    ++btl->busy_checks < BLKDEV_TRIG_HW_BLINK_CHECKS)
+		return false;
+
+	trace_blkdev_trig_blink(btl->led, 0);
+	led_blink_set_nosleep(btl->led, 0, 0);  /* driver's default rate */
+	btl->hw_blinking = true;
+	return true;
+}
+
+/**
+ * blkdev_trig_check_led() - Check the block devices linked to an LED for
+ *	activity and blink the LED.
+ * @btl:	The BTL that represents the LED
+ * @now:	Timestamp
+ *
+ * Evaluates the counters that were cached by blkdev_trig_update_led_btbs().
+ * The activity of all of the LED's block devices is combined into a single
+ * bitmask, which is tested against the LED's &blkdev_trig_led.mode once.  The
+ * scan stops as soon as every type of activity in the mode has been seen.  If
+ * the LED has thresholds, the LED only blinks if they are also met.  Sustained
+ * activity may be shown by hardware blinking (see blkdev_trig_hw_blink()).
+ *
+ * If intensity mode was disabled while a check was setting the LED's
+ * brightness, the LED may have been left at a partial brightness after
+ * intensity_mode_store() turned it off, so it is turned off again here.
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.  Takes and
+ *		releases &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_check_led(struct blkdev_trig_led *btl, ktime_t now)
+{
+	unsigned long index, mode, activity;
+	struct blkdev_trig_bdev *btb;
+	bool intensity, blink;
+
+	intensity = READ_ONCE(btl->intensity_mode);
+	/* Only the stat group bits; blkdev_trig_activate() sets all bits */
+	mode = READ_ONCE(btl->mode) & GENMASK(NR_STAT_GROUPS - 1, 0);
+
+	activity = 0;
+
+	xa_for_each (&btl->linked_btbs, index, btb) {
+		activity |= blkdev_trig_btb_activity(btb, btl->last_checked);
+		/*
+		 * Stop once every type of activity in the mode has been seen
+		 * (or, if the mode is empty, any activity, for backoff)
+		 */
+		if (activity != 0 && (activity & mode) == mode)
+			break;
+	}
+
+	if (intensity) {
+		blkdev_trig_hw_blink(btl, false);
+		blkdev_trig_intensity(btl, now);
+	} else {
+		if (READ_ONCE(btl->intensity_level) != LED_OFF) {
+			led_set_brightness(btl->led, LED_OFF);
+			WRITE_ONCE(btl->intensity_level, LED_OFF);
+		}
+		blink = (activity & mode) && blkdev_trig_threshold(btl, now);
+		if (!blkdev_trig_hw_blink(btl, blink) && blink)
+			blkdev_trig_blink_led(btl);
+	}
+
+	blkdev_trig_backoff(btl, activity != 0);
+	btl->last_checked = now;
+}
+
+/**
+ * blkdev_trig_check_events() - Blink event-driven LEDs linked to block devices
+ *	with pending events.
+ *
+ * Context:	Process context.  Caller must hold the RCU read lock.
+ */
+static void blkdev_trig_check_events(void)
+{
+	struct blkdev_trig_bdev *btb;
+	struct blkdev_trig_led *btl;
+	unsigned long index, led_index, pending;
+	bool blinked;
+
+	xa_for_each_marked (&blkdev_trig_btbs, index, btb,
+			    BLKDEV_TRIG_PENDING) {
+
+		xa_lock_irq(&blkdev_trig_btbs);
+		__xa_clear_mark(&blkdev_trig_btbs, index, BLKDEV_TRIG_PENDING);
+		xa_unlock_irq(&blkdev_trig_btbs);
+
+		pending = xchg(&btb->pending, 0);
+		if (pending == 0)
+			continue;
+
+		blinked = false;
+
+		xa_for_each (&btb->linked_btls, led_index, btl) {
+
+			if (READ_ONCE(btl->event_driven) &&
+			    (pending & READ_ONCE(btl->mode))) {
+				blkdev_trig_blink_led(btl);
+				blinked = true;
+			}
+		}
+
+		blkdev_trig_stats_blink(btb, blinked);
+	}
+}
+
+/**
+ * blkdev_trig_sched_less() - Ordering function for &blkdev_trig_sched.
+ * @a:		&blkdev_trig_led.sched_node of the first BTL
+ * @b:		&blkdev_trig_led.sched_node of the second BTL
+ *
+ * Context:	Any context.
+ * Return:	&true if the first LED is due to be checked before the second.
+ */
+static bool blkdev_trig_sched_less(struct rb_node *a, const struct rb_node *b)
+{
+	return ktime_before(rb_entry(a, struct blkdev_trig_led,
+				     sched_node)->next_check,
+			    rb_entry(b, struct blkdev_trig_led,
+				     sched_node)->next_check);
+}
+
+/**
+ * blkdev_trig_align() - Round an LED's due time to the grid.
+ * @now:	The current time
+ * @due:	The LED's due time
+ *
+ * If &blkdev_trig_grid_us is set, &due is rounded to the nearest multiple of
+ * the grid that is after &now.  Otherwise, &due is returned unchanged.
+ *
+ * Context:	Any context.
+ * Return:	The (possibly rounded) due time.
+ */
+static ktime_t blkdev_trig_align(ktime_t now, ktime_t due)
+{
+	u64 grid = (u64)READ_ONCE(blkdev_trig_grid_us) * NSEC_PER_USEC;
+	u64 t, rem;
+
+	if (grid == 0)
+		return due;
+
+	t = ktime_to_ns(due) + grid / 2;
+	div64_u64_rem(t, grid, &rem);
+	due = ns_to_ktime(t - rem);
+
+	return ktime_after(due, now) ? due : ktime_add_ns(due, grid);
+}
+
+/**
+ * blkdev_trig_sched_work() - Set the schedule of the delayed work.
+ * @delay:	Delay before the delayed work should run
+ *
+ * In &hrtimer mode, starts (or restarts) &blkdev_trig_timer, which queues the
+ * work when it expires.  Otherwise, the delay is rounded up to whole jiffies.
+ *
+ * Does nothing if an event has kicked the delayed work to run immediately;
+ * that run will set the schedule when it finishes.  Also does nothing while
+ * the delayed work is parked for system suspend.
+ *
+ * Context:	Any context.  Caller must hold &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_sched_work(ktime_t delay)
+{
+	if (test_bit(0, &blkdev_trig_kicked) || READ_ONCE(blkdev_trig_suspended))
+		return;
+
+	if (blkdev_trig_use_hrtimer) {
+		hrtimer_start_range_ns(&blkdev_trig_timer, delay,
+				       READ_ONCE(blkdev_trig_slack_us) *
+							NSEC_PER_USEC,
+				       HRTIMER_MODE_REL);
+	} else {
+		mod_delayed_work(blkdev_trig_wq, &blkdev_trig_work,
+				 DIV_ROUND_UP_ULL(ktime_to_ns(delay),
+						  TICK_NSEC));
+	}
+}
+
+/**
+ * blkdev_trig_timer_fn() - &hrtimer callback.
+ * @timer:	&blkdev_trig_timer
+ *
+ * Context:	Hard IRQ.
+ * Return:	&HRTIMER_NORESTART.
+ */
+static enum hrtimer_restart blkdev_trig_timer_fn(struct hrtimer *timer)
+{
+	mod_delayed_work(blkdev_trig_wq, &blkdev_trig_work, 0);
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * blkdev_trig_cancel_work() - Cancel the delayed work and the &hrtimer.
+ *
+ * Context:	Process context.  No LEDs may be scheduled.
+ */
+static void blkdev_trig_cancel_work(void)
+{
+	hrtimer_cancel(&blkdev_trig_timer);
+	cancel_delayed_work_sync(&blkdev_trig_work);
+}
+
+/**
+ * blkdev_trig_check() - Check linked devices for activity and blink LEDs.
+ * @work:	Delayed work (&blkdev_trig_work)
+ *
+ * Only the LEDs at the front of &blkdev_trig_sched whose
+ * &blkdev_trig_led.next_check has arrived are checked.  The check runs in
+ * phases.  First, all due LEDs are removed from the tree.  Then the counters of
+ * every block device linked to any of them are read, once per device.
+ * Next, each LED is evaluated against the cached counters.  Finally, each LED
+ * is re-inserted into the tree according to its new due time, unless the last
+ * block device linked to it was unlinked while it was being checked.
+ *
+ * If the counters of the due LEDs' block devices take longer than
+ * &blkdev_trig_budget_us to read, the LEDs that haven't been reached are put
+ * back into the tree unchecked, and the delayed work runs again immediately.
+ *
+ * Event-driven LEDs are blinked first, if any events are pending.  Blinks of
+ * LEDs whose driver supports batching are passed to the driver together, after
+ * all due LEDs have been checked.
+ *
+ * Context:	Process context.  Takes and releases the RCU read lock and
+ *		&blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_check(struct work_struct *work)
+{
+	unsigned int budget, nr_due = 0, nr_deferred = 0;
+	ktime_t now, due_by, early, late, next = 0;
+	struct blkdev_trig_led *btl;
+	LIST_HEAD(deferred);
+	LIST_HEAD(checked);
+	struct rb_node *node;
+	bool kicked;
+	LIST_HEAD(due);
+	u64 start;
+
+	rcu_read_lock();
+
+	blkdev_trig_cur_batch = rcu_dereference(blkdev_trig_batch);
+
+	/* Any event from this point on will kick the delayed work again */
+	kicked = test_and_clear_bit(0, &blkdev_trig_kicked);
+	smp_mb__after_atomic();
+
+	start = blkdev_trig_stats_begin(kicked);
+
+	blkdev_trig_check_events();
+
+	spin_lock(&blkdev_trig_sched_lock);
+
+	now = ktime_get();
+
+	late = 0;
+	if (!kicked && !RB_EMPTY_ROOT(&blkdev_trig_sched.rb_root) &&
+	    !ktime_before(now, blkdev_trig_next_check)) {
+		late = ktime_sub(now, blkdev_trig_next_check);
+		blkdev_trig_stats_late(start, late);
+	}
+
+	trace_blkdev_trig_check_start(kicked, ktime_to_ns(late));
+
+	/*
+	 * The delayed work's timer has jiffy resolution, so it may fire up to
+	 * a jiffy before an LED's precise due time.  Checking such an LED now
+	 * matches the behavior of a jiffy-based schedule, rather than running
+	 * the work again a fraction of a jiffy later.
+	 */
+	due_by = blkdev_trig_use_hrtimer ? now : ktime_add_ns(now, TICK_NSEC);
+
+	/* Also check any LED that will be due within the tolerance window */
+	early = ktime_add_us(now, READ_ONCE(blkdev_trig_tolerance_us));
+	if (ktime_after(early, due_by))
+		due_by = early;
+
+	while ((node = rb_first_cached(&blkdev_trig_sched)) != NULL) {
+
+		btl = rb_entry(node, struct blkdev_trig_led, sched_node);
+		if (ktime_after(btl->next_check, due_by))
+			break;
+
+		rb_erase_cached(node, &blkdev_trig_sched);
+		RB_CLEAR_NODE(node);
+		list_add_tail(&btl->due_node, &due);
+		++nr_due;
+	}
+
+	spin_unlock(&blkdev_trig_sched_lock);
+
+	budget = READ_ONCE(blkdev_trig_budget_us);
+
+	list_for_each_entry (btl, &due, due_node) {
+
+		blkdev_trig_update_led_btbs(btl, now);
+
+		if (budget == 0 || list_is_last(&btl->due_node, &due) ||
+		    ktime_us_delta(ktime_get(), now) < budget)
+			continue;
+
+		/* Leave the rest of the due LEDs for another run */
+		list_cut_position(&checked, &due, &btl->due_node);
+		list_splice_init(&due, &deferred);
+		list_splice(&checked, &due);
+		break;
+	}
+
+	list_for_each_entry (btl, &deferred, due_node)
+		++nr_deferred;
+
+	nr_due -= nr_deferred;
+
+	list_for_each_entry (btl, &due, due_node)
+		blkdev_trig_check_led(btl, now);
+
+	blkdev_trig_batch_flush();
+
+	spin_lock(&blkdev_trig_sched_lock);
+
+	list_for_each_entry (btl, &due, due_node) {
+
+		node = &btl->sched_node;
+
+		if (btl->scheduled && RB_EMPTY_NODE(node)) {
+			btl->next_check = blkdev_trig_align(now,
+					ktime_add(now, btl->cur_interval));
+			rb_add_cached(node, &blkdev_trig_sched,
+				      blkdev_trig_sched_less);
+		}
+	}
+
+	/* Deferred LEDs keep their (past) due times, so they're first */
+	list_for_each_entry (btl, &deferred, due_node) {
+
+		node = &btl->sched_node;
+
+		if (btl->scheduled && RB_EMPTY_NODE(node))
+			rb_add_cached(node, &blkdev_trig_sched,
+				      blkdev_trig_sched_less);
+	}
+
+	/*
+	 * If the tree is empty, either the last link has been (or is being)
+	 * removed, or all linked LEDs are event-driven.  Either way, there's
+	 * nothing to schedule.
+	 */
+	node = rb_first_cached(&blkdev_trig_sched);
+	if (node != NULL) {
+		btl = rb_entry(node, struct blkdev_trig_led, sched_node);
+		blkdev_trig_next_check = btl->next_check;
+		next = max_t(ktime_t, ktime_sub(btl->next_check, now), 0);
+		blkdev_trig_sched_work(next);
+	}
+
+	spin_unlock(&blkdev_trig_sched_lock);
+	rcu_read_unlock();
+
+	trace_blkdev_trig_check_end(nr_due, ktime_to_ns(next));
+	blkdev_trig_stats_end(start, nr_due, nr_deferred);
+}
+
+/**
+ * blkdev_trig_sched_led() - Add an LED to the schedule and set the schedule
+ *	of the delayed work accordingly.
+ * @btl:	The BTL that represents the LED
+ *
+ * Called when the number of block devices to which a polled (not event-driven)
+ * LED is linked becomes non-zero, or when an LED that is linked to at least one
+ * block device stops being event-driven.  Any backoff of the LED's check
+ * interval from a previous set of links no longer applies.  The LED's first
+ * due time is aligned to the grid (see blkdev_trig_align()), like the rest.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.  Takes
+ *		and releases &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_sched_led(struct blkdev_trig_led *btl)
+{
+	ktime_t interval = READ_ONCE(btl->check_interval);
+	ktime_t now = ktime_get();
+	ktime_t check_by = blkdev_trig_align(now, ktime_add(now, interval));
+	bool first;
+
+	spin_lock(&blkdev_trig_sched_lock);
+
+	first = RB_EMPTY_ROOT(&blkdev_trig_sched.rb_root);
+
+	btl->idle_checks = 0;
+	btl->cur_interval = interval;
+	btl->next_check = check_by;
+	btl->scheduled = true;
+
+	/* The LED may still be out of the tree, being checked */
+	if (RB_EMPTY_NODE(&btl->sched_node))
+		rb_add_cached(&btl->sched_node, &blkdev_trig_sched,
+			      blkdev_trig_sched_less);
+
+	/*
+	 * If no other LEDs are scheduled, simply schedule the delayed work
+	 * according to this LED's check_interval attribute.
+	 * Otherwise, modify the schedule only if the next check isn't already
+	 * scheduled to occur soon enough to accomodate this LED.
+	 */
+	if (first || ktime_before(check_by, blkdev_trig_next_check)) {
+		blkdev_trig_sched_work(ktime_sub(check_by, now));
+		blkdev_trig_next_check = check_by;
+	}
+
+	spin_unlock(&blkdev_trig_sched_lock);
+}
+
+/**
+ * blkdev_trig_unsched_led() - Remove an LED from the schedule.
+ * @btl:	The BTL that represents the LED
+ *
+ * Called when the number of block devices to which an LED is linked becomes
+ * zero, or when the LED becomes event-driven.  The delayed work itself is
+ * cancelled (by the caller) only when no links remain at all.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.  Takes
+ *		and releases &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_unsched_led(struct blkdev_trig_led *btl)
+{
+	spin_lock(&blkdev_trig_sched_lock);
+
+	btl->scheduled = false;
+
+	if (!RB_EMPTY_NODE(&btl->sched_node)) {
+		rb_erase_cached(&btl->sched_node, &blkdev_trig_sched);
+		RB_CLEAR_NODE(&btl->sched_node);
+	}
+
+	spin_unlock(&blkdev_trig_sched_lock);
+}
+
+/*
+ *
+ *	Event-driven activity detection
+ *
+ */
+
+#ifdef CONFIG_TRACEPOINTS
+
+/* The block_rq_complete tracepoint, if found */
+static struct tracepoint *blkdev_trig_rq_complete_tp;
+
+/**
+ * blkdev_trig_mark() - Record a pending event for a block device.
+ * @bdev:	The block device
+ * @group:	The type of activity
+ *
+ * If the block device has a BTB that is linked to at least one event-driven LED,
+ * records the activity in &blkdev_trig_bdev.pending and kicks the delayed work,
+ * unless activity of the same type is already pending.  Block devices linked
+ * only to polled LEDs are left to the periodic check, so their I/O doesn't
+ * make the delayed work run early.
+ *
+ * Context:	Any context.  Caller must be in an RCU read-side critical
+ *		section (which tracepoint probes are).
+ */
+static void blkdev_trig_mark(struct block_device *bdev, enum stat_group group)
+{
+	struct blkdev_trig_bdev *btb;
+	unsigned long flags;
+
+	btb = xa_load(&blkdev_trig_btbs, bdev->bd_dev);
+	if (btb == NULL || READ_ONCE(btb->event_leds) == 0 ||
+	    test_and_set_bit(group, &btb->pending))
+		return;
+
+	blkdev_trig_stats_event(btb);
+
+	xa_lock_irqsave(&blkdev_trig_btbs, flags);
+	__xa_set_mark(&blkdev_trig_btbs, bdev->bd_dev, BLKDEV_TRIG_PENDING);
+	xa_unlock_irqrestore(&blkdev_trig_btbs, flags);
+
+	/* While parked, the kick is left for blkdev_trig_resume() */
+	if (!test_and_set_bit(0, &blkdev_trig_kicked) &&
+	    !READ_ONCE(blkdev_trig_suspended))
+		mod_delayed_work(blkdev_trig_wq, &blkdev_trig_work, 0);
+}
+
+/**
+ * blkdev_trig_rq_complete() - ``block_rq_complete`` tracepoint probe.
+ * @data:	Probe data (unused)
+ * @rq:		The request
+ * @error:	Completion status (unused)
+ * @nr_bytes:	Number of bytes completed (unused)
+ *
+ * Context:	Any context (usually hard or soft IRQ).
+ */
+static void blkdev_trig_rq_complete(void *data, struct request *rq,
+				    blk_status_t error, unsigned int nr_bytes)
+{
+	struct block_device *part = rq->part;
+	enum stat_group group;
+
+	/* Requests that aren't accounted don't have a partition */
+	if (part == NULL)
+		return;
+
+	if (req_op(rq) == REQ_OP_FLUSH)
+		group = STAT_FLUSH;
+	else
+		group = op_stat_group(req_op(rq));
+
+	blkdev_trig_mark(part, group);
+
+	if (bdev_is_partition(part))
+		blkdev_trig_mark(bdev_whole(part), group);
+}
+
+/**
+ * blkdev_trig_event_get() - Take a reference to the tracepoint probe.
+ *
+ * Registers the probe, if this is the first event-driven LED.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_event_get(void)
+{
+	int err;
+
+	if (blkdev_trig_rq_complete_tp == NULL)
+		return -EOPNOTSUPP;
+
+	if (blkdev_trig_event_leds == 0) {
+		err = tracepoint_probe_register(blkdev_trig_rq_complete_tp,
+						blkdev_trig_rq_complete, NULL);
+		if (err)
+			return err;
+	}
+
+	++blkdev_trig_event_leds;
+	return 0;
+}
+
+/**
+ * blkdev_trig_event_put() - Drop a reference to the tracepoint probe.
+ *
+ * Unregisters the probe, if this was the last event-driven LED.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_event_put(void)
+{
+	if (--blkdev_trig_event_leds != 0)
+		return;
+
+	WARN_ON(tracepoint_probe_unregister(blkdev_trig_rq_complete_tp,
+					    blkdev_trig_rq_complete, NULL));
+	tracepoint_synchronize_unregister();
+}
+
+/**
+ * blkdev_trig_find_tp() - Find the ``block_rq_complete`` tracepoint.
+ * @tp:		A kernel tracepoint
+ * @priv:	Private data (unused)
+ *
+ * Called by for_each_kernel_tracepoint() during module initialization.
+ */
+static void __init blkdev_trig_find_tp(struct tracepoint *tp, void *priv)
+{
+	if (strcmp(tp->name, "block_rq_complete") == 0)
+		blkdev_trig_rq_complete_tp = tp;
+}
+
+/**
+ * blkdev_trig_event_init() - Prepare for event-driven LEDs.
+ *
+ * If the tracepoint isn't found, LEDs can only be polled.
+ */
+static void __init blkdev_trig_event_init(void)
+{
+	for_each_kernel_tracepoint(blkdev_trig_find_tp, NULL);
+
+	if (blkdev_trig_rq_complete_tp == NULL)
+		pr_info("block_rq_complete tracepoint not found; event-driven LEDs not available\n");
+}
+
+#else	/* CONFIG_TRACEPOINTS */
+
+static int blkdev_trig_event_get(void)
+{
+	return -EOPNOTSUPP;
+}
+
+static void blkdev_trig_event_put(void)
+{
+}
+
+static void __init blkdev_trig_event_init(void)
+{
+}
+
+#endif	/* CONFIG_TRACEPOINTS */
+
+
+/*
+ *
+ *	System suspend
+ *
+ */
+
+/**
+ * blkdev_trig_resync_btb() - Re-read a BTB's counters without recording
+ *	activity.
+ * @btb:	The BTB
+ *
+ * Any events reported while the system was suspending or resuming are also
+ * discarded.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex, and the
+ *		delayed work must be parked.
+ */
+static void blkdev_trig_resync_btb(struct blkdev_trig_bdev *btb)
+{
+	unsigned long ios[NR_STAT_GROUPS], sectors[NR_STAT_GROUPS];
+
+	/* The stamp only moves forward, so the next check reads the counters */
+	btb->stamp = READ_ONCE(btb->bdev->bd_stamp) - 1;
+
+	blkdev_trig_read_ios(btb->bdev, ios, sectors);
+	memcpy(btb->ios, ios, sizeof(btb->ios));
+	memcpy(btb->sectors, sectors, sizeof(btb->sectors));
+
+	xchg(&btb->pending, 0);
+	btb->last_full = ktime_get();
+	btb->last_flush = btb->last_full;
+}
+
+/**
+ * blkdev_trig_suspend() - Park the delayed work for system suspend.
+ *
+ * blkdev_trig_mark() checks &blkdev_trig_suspended without any lock, so a
+ * probe that read it just before it was set could still kick the delayed work.
+ * Probes run in RCU read-side critical sections, so waiting for a grace period
+ * after setting the flag ensures that every such probe has finished before the
+ * work is cancelled; later probes see the flag.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_suspend(void)
+{
+	spin_lock(&blkdev_trig_sched_lock);
+	WRITE_ONCE(blkdev_trig_suspended, true);
+	spin_unlock(&blkdev_trig_sched_lock);
+
+	synchronize_rcu();
+	blkdev_trig_cancel_work();
+}
+
+/**
+ * blkdev_trig_resume() - Resynchronize all BTBs and restart the delayed work
+ *	after system resume.
+ *
+ * Every scheduled LED is overdue, so the delayed work runs immediately, and
+ * reschedules them all from the current time.  &blkdev_trig_next_check is
+ * reset, so that time spent suspended isn't counted as lateness.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex, the RCU
+ *		read lock, and &blkdev_trig_sched_lock.
+ */
+static void blkdev_trig_resume(void)
+{
+	struct blkdev_trig_bdev *btb;
+	unsigned long index;
+
+	mutex_lock(&blkdev_trig_mutex);
+	rcu_read_lock();
+
+	if (READ_ONCE(blkdev_trig_suspended)) {
+		xa_for_each (&blkdev_trig_btbs, index, btb)
+			blkdev_trig_resync_btb(btb);
+	}
+
+	spin_lock(&blkdev_trig_sched_lock);
+
+	WRITE_ONCE(blkdev_trig_suspended, false);
+	smp_mb();  /* pairs with test_and_set_bit() in blkdev_trig_mark() */
+
+	if (test_bit(0, &blkdev_trig_kicked)) {
+		mod_delayed_work(blkdev_trig_wq, &blkdev_trig_work, 0);
+	} else if (!RB_EMPTY_ROOT(&blkdev_trig_sched.rb_root)) {
+		blkdev_trig_next_check = ktime_get();
+		blkdev_trig_sched_work(0);
+	}
+
+	spin_unlock(&blkdev_trig_sched_lock);
+	rcu_read_unlock();
+	mutex_unlock(&blkdev_trig_mutex);
+}
+
+/**
+ * blkdev_trig_pm_notify() - PM notifier callback.
+ * @nb:		The notifier block (&blkdev_trig_pm_nb)
+ * @action:	The PM event
+ * @data:	Unused
+ *
+ * The ``POST`` events are also sent if the suspend or hibernation fails.
+ *
+ * Context:	Process context.
+ * Return:	&NOTIFY_DONE.
+ */
+static int blkdev_trig_pm_notify(struct notifier_block *nb,
+				 unsigned long action, void *data)
+{
+	switch (action) {
+	case PM_HIBERNATION_PREPARE:
+	case PM_SUSPEND_PREPARE:
+		blkdev_trig_suspend();
+		break;
+	case PM_POST_HIBERNATION:
+	case PM_POST_RESTORE:
+	case PM_POST_SUSPEND:
+		blkdev_trig_resume();
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block blkdev_trig_pm_nb = {
+	.notifier_call	= blkdev_trig_pm_notify,
+};
+
+
+/*
+ *
+ *	BTB registry (by device number and by name)
+ *
+ */
+
+/**
+ * blkdev_trig_name_hash() - Hash a block device name.
+ * @data:	The name
+ * @len:	Unused (names are null-terminated)
+ * @seed:	Hash seed
+ *
+ * Context:	Any context.
+ * Return:	The hash value.
+ */
+static u32 blkdev_trig_name_hash(const void *data, u32 len, u32 seed)
+{
+	return jhash(data, strlen(data), seed);
+}
+
+/**
+ * blkdev_trig_btb_name_hash() - Hash the name of a BTB's block device.
+ * @data:	The BTB
+ * @len:	Unused
+ * @seed:	Hash seed
+ *
+ * Context:	Any context.
+ * Return:	The hash value.
+ */
+static u32 blkdev_trig_btb_name_hash(const void *data, u32 len, u32 seed)
+{
+	const struct blkdev_trig_bdev *btb = data;
+
+	return blkdev_trig_name_hash(dev_name(&btb->bdev->bd_device), 0, seed);
+}
+
+/**
+ * blkdev_trig_btb_name_cmp() - Compare a block device name to a BTB.
+ * @arg:	&struct rhashtable_compare_arg (the key is the name)
+ * @obj:	The BTB
+ *
+ * Context:	Any context.
+ * Return:	&0 if the BTB's block device has the name, non-zero otherwise.
+ */
+static int blkdev_trig_btb_name_cmp(struct rhashtable_compare_arg *arg,
+				    const void *obj)
+{
+	const struct blkdev_trig_bdev *btb = obj;
+
+	return strcmp(dev_name(&btb->bdev->bd_device), arg->key);
+}
+
+/* Parameters for blkdev_trig_names (keys are null-terminated names) */
+static const struct rhashtable_params blkdev_trig_names_params = {
+	.head_offset		= offsetof(struct blkdev_trig_bdev, name_node),
+	.hashfn			= blkdev_trig_name_hash,
+	.obj_hashfn		= blkdev_trig_btb_name_hash,
+	.obj_cmpfn		= blkdev_trig_btb_name_cmp,
+	.automatic_shrinking	= true,
+};
+
+/**
+ * blkdev_trig_register_btb() - Add a BTB to &blkdev_trig_btbs and
+ *	&blkdev_trig_names.
+ * @btb:	The BTB
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_register_btb(struct blkdev_trig_bdev *btb)
+{
+	struct block_device *bdev = btb->bdev;
+	int err;
+
+	err = rhashtable_insert_fast(&blkdev_trig_names, &btb->name_node,
+				     blkdev_trig_names_params);
+	if (err)
+		return err;
+
+	err = xa_insert_irq(&blkdev_trig_btbs, bdev->bd_dev, btb, GFP_KERNEL);
+	if (err)
+		rhashtable_remove_fast(&blkdev_trig_names, &btb->name_node,
+				       blkdev_trig_names_params);
+
+	return err;
+}
+
+/**
+ * blkdev_trig_unregister_btb() - Remove a BTB from &blkdev_trig_btbs and
+ *	&blkdev_trig_names.
+ * @btb:	The BTB
+ *
+ * Does nothing if the BTB has already been unregistered (by
+ * blkdev_trig_put_btb(), if the block device was removed while its last link
+ * was being removed).
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_unregister_btb(struct blkdev_trig_bdev *btb)
+{
+	if (xa_cmpxchg_irq(&blkdev_trig_btbs, btb->bdev->bd_dev, btb, NULL,
+			   0) != btb)
+		return;
+
+	rhashtable_remove_fast(&blkdev_trig_names, &btb->name_node,
+			       blkdev_trig_names_params);
+}
+
+
+/*
+ *
+ *	Linking and unlinking LEDs and block devices
+ *
+ */
+
+/**
+ * blkdev_trig_link() - Link a block device to an LED.
+ * @btl:	The BTL that represents the LED
+ * @btb:	The BTB that represents the block device
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_link(struct blkdev_trig_led *btl,
+			    struct blkdev_trig_bdev *btb)
+{
+	bool led_first_link;
+	int err;
+
+	led_first_link = xa_empty(&btl->linked_btbs);
+
+	err = xa_insert(&btb->linked_btls, btl->index, btl, GFP_KERNEL);
+	if (err)
+		return err;
+
+	err = xa_insert(&btl->linked_btbs, btb->index, btb, GFP_KERNEL);
+	if (err)
+		goto error_erase_btl;
+
+	WRITE_ONCE(btl->link_gen, btl->link_gen + 1);
+
+	if (btl->event_driven)
+		WRITE_ONCE(btb->event_leds, btb->event_leds + 1);
+
+	if (!blkdev_trig_sysfs_links)
+		goto skip_symlinks;
+
+	/* Create /sys/class/block/<bdev>/linked_leds/<led> symlink */
+	err = sysfs_add_link_to_group(bdev_kobj(btb->bdev),
+				      blkdev_trig_linked_leds.name,
+				      &btl->led->dev->kobj, btl->led->name);
+	if (err)
+		goto error_erase_btb;
+
+	/* Create /sys/class/leds/<led>/linked_devices/<bdev> symlink */
+	err = sysfs_add_link_to_group(&btl->led->dev->kobj,
+				      blkdev_trig_linked_devs.name,
+				      bdev_kobj(btb->bdev),
+				      dev_name(&btb->bdev->bd_device));
+	if (err)
+		goto error_remove_symlink;
+
+skip_symlinks:
+
+	/*
+	 * If this is the first block device linked to this (polled) LED, the
+	 * delayed work schedule may need to be changed.
+	 */
+	if (led_first_link && !btl->event_driven)
+		blkdev_trig_sched_led(btl);
+
+	++blkdev_trig_link_count;
+
+	return 0;
+
+error_remove_symlink:
+	sysfs_remove_link_from_group(bdev_kobj(btb->bdev),
+				     blkdev_trig_linked_leds.name,
+				     btl->led->name);
+error_erase_btb:
+	if (btl->event_driven)
+		WRITE_ONCE(btb->event_leds, btb->event_leds - 1);
+	xa_erase(&btl->linked_btbs, btb->index);
+error_erase_btl:
+	xa_erase(&btb->linked_btls, btl->index);
+	return err;
+}
+
+/**
+ * blkdev_trig_free_btb() - Free a BTB after an RCU grace period.
+ * @rcu:	The BTB's &rcu
+ *
+ * Context:	Softirq (RCU callback).
+ */
+static void blkdev_trig_free_btb(struct rcu_head *rcu)
+{
+	kmem_cache_free(blkdev_trig_btb_cache,
+			container_of(rcu, struct blkdev_trig_bdev, rcu));
+}
+
+/**
+ * blkdev_trig_put_btb() - Remove and free a BTB, if it is no longer needed.
+ * @btb:	The BTB
+ *
+ * Does nothing if the BTB (block device) is still linked to at least one LED.
+ *
+ * If the block device is being removed, the driver core has already detached
+ * the BTB's device resource, and blkdev_trig_btb_release() is waiting for
+ * &blkdev_trig_mutex.  In that case, the release function frees the BTB.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_put_btb(struct blkdev_trig_bdev *btb)
+{
+	struct block_device *bdev = btb->bdev;
+	int err;
+
+	if (xa_empty(&btb->linked_btls)) {
+
+		if (blkdev_trig_sysfs_links)
+			sysfs_remove_group(bdev_kobj(bdev),
+					   &blkdev_trig_linked_leds);
+		blkdev_trig_unregister_btb(btb);
+
+		/* Any check (or probe) might still be using the BTB */
+		err = devres_destroy(&bdev->bd_device, blkdev_trig_btb_release,
+				     NULL, NULL);
+		if (err == 0)
+			call_rcu(&btb->rcu, blkdev_trig_free_btb);
+	}
+}
+
+/**
+ * _blkdev_trig_unlink_always() - Perform the unconditionally required steps of
+ *	unlinking a block device from an LED.
+ * @btl:	The BTL that represents the LED
+ * @btb:	The BTB that represents the block device
+ *
+ * When a block device is unlinked from an LED, certain steps must be performed
+ * only if the block device is **not** being released.  This function performs
+ * those steps that are **always** required, whether or not the block device is
+ * being released.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void _blkdev_trig_unlink_always(struct blkdev_trig_led *btl,
+				       struct blkdev_trig_bdev *btb)
+{
+	--blkdev_trig_link_count;
+
+	if (blkdev_trig_link_count == 0)
+		blkdev_trig_cancel_work();
+
+	xa_erase(&btb->linked_btls, btl->index);
+	xa_erase(&btl->linked_btbs, btb->index);
+	WRITE_ONCE(btl->link_gen, btl->link_gen + 1);
+
+	if (btl->event_driven)
+		WRITE_ONCE(btb->event_leds, btb->event_leds - 1);
+
+	if (xa_empty(&btl->linked_btbs))
+		blkdev_trig_unsched_led(btl);
+
+	/* Remove /sys/class/leds/<led>/linked_devices/<bdev> symlink */
+	if (blkdev_trig_sysfs_links)
+		sysfs_remove_link_from_group(&btl->led->dev->kobj,
+					     blkdev_trig_linked_devs.name,
+					     dev_name(&btb->bdev->bd_device));
+}
+
+/**
+ * blkdev_trig_unlink_norelease() - Unlink an LED from a block device that is
+ *	**not** being released.
+ * @btl:	The BTL that represents the LED.
+ * @btb:	The BTB that represents the block device.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_unlink_norelease(struct blkdev_trig_led *btl,
+					 struct blkdev_trig_bdev *btb)
+{
+	_blkdev_trig_unlink_always(btl, btb);
+
+	/* Remove /sys/class/block/<bdev>/linked_leds/<led> symlink */
+	if (blkdev_trig_sysfs_links)
+		sysfs_remove_link_from_group(bdev_kobj(btb->bdev),
+					     blkdev_trig_linked_leds.name,
+					     btl->led->name);
+
+	blkdev_trig_put_btb(btb);
+}
+
+/**
+ * blkdev_trig_unlink_release() - Unlink an LED from a block device that is
+ *	being released.
+ * @btl:	The BTL that represents the LED
+ * @btb:	The BTB that represents the block device
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_unlink_release(struct blkdev_trig_led *btl,
+				       struct blkdev_trig_bdev *btb)
+{
+	_blkdev_trig_unlink_always(btl, btb);
+
+	/*
+	 * If the BTB is being released, the driver core has already removed the
+	 * device's attribute groups, and the BTB will be freed automatically,
+	 * so there's nothing else to do.
+	 */
+}
+
+
+/*
+ *
+ *	BTB creation
+ *
+ */
+
+/**
+ * blkdev_trig_btb_release() - BTB device resource release function.
+ * @dev:	The block device
+ * @res:	The device resource, which points to the BTB
+ *
+ * Called by the driver core when a block device with a BTB is removed.  The
+ * BTB may already have been unlinked from its last LED and unregistered by
+ * blkdev_trig_put_btb(), which leaves it to this function to free.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ */
+static void blkdev_trig_btb_release(struct device *dev, void *res)
+{
+	struct blkdev_trig_bdev *btb = *(struct blkdev_trig_bdev **)res;
+	struct blkdev_trig_led *btl;
+	unsigned long index;
+
+	mutex_lock(&blkdev_trig_mutex);
+
+	xa_for_each (&btb->linked_btls, index, btl)
+		blkdev_trig_unlink_release(btl, btb);
+
+	blkdev_trig_unregister_btb(btb);
+
+	mutex_unlock(&blkdev_trig_mutex);
+
+	/* The driver core frees the device resource when this function returns */
+	call_rcu(&btb->rcu, blkdev_trig_free_btb);
+}
+
+/**
+ * blkdev_trig_split() - Split a list of block devices.
+ * @buf:	The value written to one of an LED's link or unlink attributes
+ * @count:	The number of characters in &buf
+ * @argc:	Output - the number of items in the list
+ *
+ * Items may be separated by whitespace and/or commas.  The caller must call
+ * argv_free() when finished with the list.
+ *
+ * Context:	Process context.
+ * Return:	Array of null-terminated items, or an error pointer.
+ */
+static char **blkdev_trig_split(const char *buf, size_t count, int *argc)
+{
+	char **argv, *copy, *c;
+
+	copy = kmemdup_nul(buf, count, GFP_KERNEL);
+	if (copy == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	for (c = copy; *c != 0; ++c) {
+		if (*c == ',')
+			*c = ' ';
+	}
+
+	argv = argv_split(GFP_KERNEL, copy, argc);
+	kfree(copy);
+
+	if (argv == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	if (*argc == 0) {
+		argv_free(argv);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return argv;
+}
+
+/**
+ * blkdev_trig_put_bdevs() - Put block devices opened by
+ *	blkdev_trig_get_bdevs().
+ * @bdevs:	The block devices
+ * @count:	The number of block devices
+ *
+ * Also frees &bdevs.
+ *
+ * Context:	Process context.
+ */
+static void blkdev_trig_put_bdevs(struct block_device **bdevs,
+				  unsigned int count)
+{
+	while (count-- > 0)
+		blkdev_put(bdevs[count], THIS_MODULE);
+
+	kfree(bdevs);
+}
+
+/**
+ * blkdev_trig_get_bdevs() - Get block devices by path.
+ * @buf:	The value written to an LED's &link_dev_by_path or
+ *		&unlink_dev_by_path attribute, which should be a list of paths
+ *		to special files that represent block devices
+ * @count:	The number of characters in &buf
+ * @nr_bdevs:	Output - the number of block devices
+ *
+ * All of the block devices are opened before the caller takes
+ * &blkdev_trig_mutex, so that a slow open doesn't delay other link changes.
+ * The caller must call blkdev_trig_put_bdevs() when finished with the devices.
+ *
+ * Context:	Process context.
+ * Return:	Array of block devices, or an error pointer.
+ */
+static struct block_device **blkdev_trig_get_bdevs(const char *buf,
+						   size_t count,
+						   unsigned int *nr_bdevs)
+{
+	struct block_device **bdevs, *bdev;
+	char **argv;
+	int argc, i;
+
+	argv = blkdev_trig_split(buf, count, &argc);
+	if (IS_ERR(argv))
+		return ERR_CAST(argv);
+
+	bdevs = kcalloc(argc, sizeof(*bdevs), GFP_KERNEL);
+	if (bdevs == NULL) {
+		bdevs = ERR_PTR(-ENOMEM);
+		goto exit_free_argv;
+	}
+
+	for (i = 0; i < argc; ++i) {
+
+		bdev = blkdev_get_by_path(argv[i], BLK_OPEN_READ, THIS_MODULE,
+					  NULL);
+		if (IS_ERR(bdev)) {
+			blkdev_trig_put_bdevs(bdevs, i);
+			bdevs = ERR_CAST(bdev);
+			goto exit_free_argv;
+		}
+
+		bdevs[i] = bdev;
+	}
+
+	*nr_bdevs = argc;
+
+exit_free_argv:
+	argv_free(argv);
+	return bdevs;
+}
+
+/**
+ * blkdev_trig_get_btb() - Find or create the BTB for a block device.
+ * @bdev:	The block device
+ *
+ * If a new BTB is created, because the block device was not previously linked
+ * to any LEDs, the block device's &linked_leds &sysfs directory is created
+ * (unless &blkdev_trig_sysfs_links is cleared).
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	Pointer to the BTB, error pointer on error.
+ */
+static struct blkdev_trig_bdev *blkdev_trig_get_btb(struct block_device *bdev)
+{
+	struct blkdev_trig_bdev *btb, **res;
+	int err;
+
+	btb = xa_load(&blkdev_trig_btbs, bdev->bd_dev);
+	if (btb != NULL)
+		return btb;
+
+	if (blkdev_trig_next_index == ULONG_MAX)
+		return ERR_PTR(-EOVERFLOW);
+
+	btb = kmem_cache_zalloc(blkdev_trig_btb_cache, GFP_KERNEL);
+	if (btb == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	res = devres_alloc(blkdev_trig_btb_release, sizeof(*res), GFP_KERNEL);
+	if (res == NULL) {
+		err = -ENOMEM;
+		goto exit_free_btb;
+	}
+
+	*res = btb;
+
+	if (blkdev_trig_sysfs_links) {
+		err = sysfs_create_group(bdev_kobj(bdev),
+					 &blkdev_trig_linked_leds);
+		if (err)
+			goto exit_free_res;
+	}
+
+	btb->index = blkdev_trig_next_index++;
+	btb->bdev = bdev;
+	xa_init(&btb->linked_btls);
+
+	/* Populate BTB activity counters */
+	blkdev_trig_update_btb(btb, ktime_get(), false, true);
+
+	err = blkdev_trig_register_btb(btb);
+	if (err)
+		goto exit_remove_group;
+
+	devres_add(&bdev->bd_device, res);
+	return btb;
+
+exit_remove_group:
+	if (blkdev_trig_sysfs_links)
+		sysfs_remove_group(bdev_kobj(bdev), &blkdev_trig_linked_leds);
+exit_free_res:
+	devres_free(res);
+exit_free_btb:
+	kmem_cache_free(blkdev_trig_btb_cache, btb);
+	return ERR_PTR(err);
+}
+
+/**
+ * blkdev_trig_parse_devt() - Parse a device number.
+ * @id:		The device number, in ``<major>:<minor>`` format
+ * @devt:	Output - the device number
+ *
+ * Context:	Any context.
+ * Return:	&0 on success, &-EINVAL if &id is not a valid device number.
+ */
+static int blkdev_trig_parse_devt(const char *id, dev_t *devt)
+{
+	unsigned int major, minor;
+	char extra;
+
+	if (sscanf(id, "%u:%u%c", &major, &minor, &extra) != 2)
+		return -EINVAL;
+
+	*devt = MKDEV(major, minor);
+	if (MAJOR(*devt) != major || MINOR(*devt) != minor)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * blkdev_trig_find_registered() - Find a block device that already has a BTB.
+ * @id:		Device name or number
+ * @by_devt:	Whether &id is a device number (``<major>:<minor>``)
+ * @devt:	The parsed device number (if &by_devt is &true)
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	The block device, or &NULL if it has no BTB.
+ */
+static struct block_device *blkdev_trig_find_registered(const char *id,
+							 bool by_devt,
+							 dev_t devt)
+{
+	struct blkdev_trig_bdev *btb;
+
+	if (by_devt)
+		btb = xa_load(&blkdev_trig_btbs, devt);
+	else
+		btb = rhashtable_lookup_fast(&blkdev_trig_names, id,
+					     blkdev_trig_names_params);
+
+	return btb ? btb->bdev : NULL;
+}
+
+/**
+ * blkdev_trig_find_bdev() - Find a block device by name or device number,
+ *	without opening it.
+ * @id:		The kernel name (e.g. ``sda``) or device number (e.g.
+ *		``8:0``) of the block device
+ * @by_devt:	Whether &id is a device number
+ *
+ * The block device is found (in order of preference):
+ *
+ * * In &blkdev_trig_btbs, if it is already linked to any LED.
+ *
+ * * In the block device class (see blkdev_trig_find_block_class()).
+ *
+ * The block device is never opened, so finding it can't spin up a disk or
+ * stall on a device that is resetting.
+ *
+ * The caller must call put_device() on the block device's &bd_device when
+ * finished with it.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	The block device, or an error pointer.
+ */
+static struct block_device *blkdev_trig_find_bdev(const char *id, bool by_devt)
+{
+	struct block_device *bdev;
+	struct device *dev;
+	dev_t devt = 0;
+	int err;
+
+	if (by_devt) {
+		err = blkdev_trig_parse_devt(id, &devt);
+		if (err)
+			return ERR_PTR(err);
+	}
+
+	bdev = blkdev_trig_find_registered(id, by_devt, devt);
+	if (bdev != NULL) {
+		get_device(&bdev->bd_device);
+		return bdev;
+	}
+
+	if (by_devt)
+		dev = class_find_device_by_devt(blkdev_trig_block_class, devt);
+	else
+		dev = class_find_device_by_name(blkdev_trig_block_class, id);
+
+	return dev ? dev_to_bdev(dev) : ERR_PTR(-ENODEV);
+}
+
+/* Maximum depth of a stack of block devices expanded by &link_slaves */
+#define BLKDEV_TRIG_STACK_MAX	8
+
+/**
+ * struct blkdev_trig_slaves - The slaves of a stacked block device.
+ * @dir:	The stacked device's ``slaves`` directory
+ * @bdevs:	The slaves (each holds a reference to its &bd_device)
+ * @nr_bdevs:	The number of block devices in &bdevs
+ */
+struct blkdev_trig_slaves {
+	struct kernfs_node	*dir;
+	struct block_device	**bdevs;
+	unsigned int		nr_bdevs;
+};
+
+/**
+ * blkdev_trig_slaves_match() - class_for_each_device() function that records
+ *	a block device if it is a slave of a stacked block device.
+ * @dev:	The &bd_device of a block device
+ * @data:	The slaves found so far (a &struct blkdev_trig_slaves)
+ *
+ * The block layer links each slave into the stacked device's ``slaves``
+ * directory under the slave's kernel name, so a block device is a slave if
+ * that directory has an entry with its name.
+ *
+ * Context:	Process context.
+ * Return:	&0 to continue the iteration, &-ENOMEM on error.
+ */
+static int blkdev_trig_slaves_match(struct device *dev, void *data)
+{
+	struct blkdev_trig_slaves *slaves = data;
+	struct block_device **bdevs;
+	struct kernfs_node *kn;
+
+	kn = sysfs_get_dirent(slaves->dir, dev_name(dev));
+	if (kn == NULL)
+		return 0;
+
+	sysfs_put(kn);
+
+	bdevs = krealloc_array(slaves->bdevs, slaves->nr_bdevs + 1,
+			       sizeof(*bdevs), GFP_KERNEL);
+	if (bdevs == NULL)
+		return -ENOMEM;
+
+	get_device(dev);
+	bdevs[slaves->nr_bdevs++] = dev_to_bdev(dev);
+	slaves->bdevs = bdevs;
+	return 0;
+}
+
+/**
+ * blkdev_trig_get_slaves() - Find the slaves of a block device.
+ * @bdev:	The block device
+ * @slaves:	Output - the slaves (must be zeroed by the caller)
+ *
+ * The slaves of a stacked block device are the block devices that it is
+ * built on (e.g. the members of an MD RAID array); they are linked in its
+ * ``slaves`` directory in &sysfs.  They are found by looking up each block
+ * device in that directory's &kernfs node, without any file I/O, so linking
+ * doesn't depend on where (or whether) &sysfs is mounted.  A partition, or a
+ * block device that is not stacked, has no slaves.  The caller must call
+ * blkdev_trig_put_slaves() when finished with the slaves, even on error.
+ *
+ * Context:	Process context.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_get_slaves(struct block_device *bdev,
+				  struct blkdev_trig_slaves *slaves)
+{
+	int err;
+
+	if (bdev_is_partition(bdev))
+		return 0;
+
+	/* Holds a reference, even if the disk is deleted meanwhile */
+	slaves->dir = sysfs_get_dirent(bdev_kobj(bdev)->sd, "slaves");
+	if (slaves->dir == NULL)
+		return 0;
+
+	err = class_for_each_device(blkdev_trig_block_class, NULL, slaves,
+				    blkdev_trig_slaves_match);
+	sysfs_put(slaves->dir);
+
+	return err;
+}
+
+/**
+ * blkdev_trig_put_slaves() - Put block devices found by
+ *	blkdev_trig_get_slaves().
+ * @slaves:	The slaves
+ *
+ * Context:	Process context.
+ */
+static void blkdev_trig_put_slaves(struct blkdev_trig_slaves *slaves)
+{
+	while (slaves->nr_bdevs-- > 0)
+		put_device(&slaves->bdevs[slaves->nr_bdevs]->bd_device);
+
+	kfree(slaves->bdevs);
+}
+
+/**
+ * blkdev_trig_add_members() - Add the physical members of a (possibly
+ *	stacked) block device to a list.
+ * @bdev:	The block device
+ * @members:	The list, which is reallocated as it grows
+ * @nr_members:	The number of block devices in &members
+ * @depth:	The depth of &bdev in the stack (&0 for the device being
+ *		linked)
+ *
+ * A block device with no slaves is its own (only) member; otherwise, its
+ * members are those of each of its slaves.  Members that are already in the
+ * list (e.g. a disk beneath two listed volumes) are not added again.  The
+ * list holds a reference to each member's &bd_device.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_add_members(struct block_device *bdev,
+				   struct block_device ***members,
+				   unsigned int *nr_members,
+				   unsigned int depth)
+{
+	struct blkdev_trig_slaves slaves = { 0 };
+	struct block_device **new;
+	unsigned int i;
+	int err;
+
+	if (depth > BLKDEV_TRIG_STACK_MAX)
+		return -ELOOP;
+
+	err = blkdev_trig_get_slaves(bdev, &slaves);
+	if (err)
+		goto exit_put_slaves;
+
+	for (i = 0; i < slaves.nr_bdevs; ++i) {
+		err = blkdev_trig_add_members(slaves.bdevs[i], members,
+					      nr_members, depth + 1);
+		if (err)
+			goto exit_put_slaves;
+	}
+
+	if (slaves.nr_bdevs != 0)
+		goto exit_put_slaves;
+
+	for (i = 0; i < *nr_members; ++i) {
+		if ((*members)[i] == bdev)
+			goto exit_put_slaves;
+	}
+
+	new = krealloc_array(*members, *nr_members + 1, sizeof(*new),
+			     GFP_KERNEL);
+	if (new == NULL) {
+		err = -ENOMEM;
+		goto exit_put_slaves;
+	}
+
+	get_device(&bdev->bd_device);
+	new[(*nr_members)++] = bdev;
+	*members = new;
+
+exit_put_slaves:
+	blkdev_trig_put_slaves(&slaves);
+	return err;
+}
+
+/**
+ * blkdev_trig_put_members() - Put block devices found by
+ *	blkdev_trig_get_members().
+ * @members:	The block devices
+ * @nr_members:	The number of block devices
+ *
+ * Also frees &members.
+ *
+ * Context:	Process context.
+ */
+static void blkdev_trig_put_members(struct block_device **members,
+				    unsigned int nr_members)
+{
+	while (nr_members-- > 0)
+		put_device(&members[nr_members]->bd_device);
+
+	kfree(members);
+}
+
+/**
+ * blkdev_trig_get_members() - Expand stacked block devices to their physical
+ *	members.
+ * @bdevs:	The block devices
+ * @nr_bdevs:	The number of block devices
+ * @nr_members:	Output - the number of members
+ *
+ * The caller must call blkdev_trig_put_members() when finished with the
+ * members.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	Array of member block devices, or an error pointer.
+ */
+static struct block_device **
+blkdev_trig_get_members(struct block_device **bdevs, unsigned int nr_bdevs,
+			unsigned int *nr_members)
+{
+	struct block_device **members = NULL;
+	unsigned int i;
+	int err = 0;
+
+	*nr_members = 0;
+
+	for (i = 0; i < nr_bdevs && !err; ++i)
+		err = blkdev_trig_add_members(bdevs[i], &members, nr_members, 0);
+
+	if (err) {
+		blkdev_trig_put_members(members, *nr_members);
+		return ERR_PTR(err);
+	}
+
+	return members;
+}
+
+/*
+ *
+ *	Activating and deactivating the trigger on an LED
+ *
+ */
+
+/**
+ * blkdev_trig_activate() - Called by the LEDs subsystem when an LED is
+ *	associated with the trigger.
+ * @led:	The LED
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_activate(struct led_classdev *led)
+{
+	struct blkdev_trig_led *btl;
+	int err;
+
+	btl = kmem_cache_zalloc(blkdev_trig_btl_cache, GFP_KERNEL);
+	if (btl == NULL)
+		return -ENOMEM;
+
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		goto exit_free;
+
+	if (blkdev_trig_next_index == ULONG_MAX) {
+		err = -EOVERFLOW;
+		goto exit_unlock;
+	}
+
+	btl->index = blkdev_trig_next_index++;
+	btl->last_checked = ktime_get();
+	btl->mode = -1;  /* set all bits */
+	btl->led = led;
+	btl->blink_msec = BLKDEV_TRIG_BLINK_DEF;
+	btl->check_interval = ms_to_ktime(BLKDEV_TRIG_CHECK_DEF);
+	btl->cur_interval = btl->check_interval;
+	btl->intensity_full = BLKDEV_TRIG_FULL_DEF;
+	btl->snap_gen = -1;  /* force a new snapshot on the first check */
+	xa_init(&btl->linked_btbs);
+	RB_CLEAR_NODE(&btl->sched_node);
+	INIT_LIST_HEAD(&btl->rule_node);
+
+	led_set_trigger_data(led, btl);
+
+exit_unlock:
+	mutex_unlock(&blkdev_trig_mutex);
+exit_free:
+	if (err)
+		kmem_cache_free(blkdev_trig_btl_cache, btl);
+	return err;
+}
+
+/**
+ * blkdev_trig_free_btl() - Free a BTL after an RCU grace period.
+ * @rcu:	The BTL's &rcu
+ *
+ * Context:	Softirq (RCU callback).
+ */
+static void blkdev_trig_free_btl(struct rcu_head *rcu)
+{
+	kmem_cache_free(blkdev_trig_btl_cache,
+			container_of(rcu, struct blkdev_trig_led, rcu));
+}
+
+/**
+ * blkdev_trig_deactivate() - Called by the the LEDs subsystem when an LED is
+ *	disassociated from the trigger.
+ * @led:	The LED
+ *
+ * The LEDs subsystem also calls this function when an LED associated with the
+ * trigger is removed or when the trigger is unregistered (if the module is
+ * unloaded).
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ */
+static void blkdev_trig_deactivate(struct led_classdev *led)
+{
+	struct blkdev_trig_led *btl = led_get_trigger_data(led);
+	struct blkdev_trig_bdev *btb;
+	unsigned long index;
+
+	mutex_lock(&blkdev_trig_mutex);
+
+	list_del(&btl->rule_node);
+
+	xa_for_each (&btl->linked_btbs, index, btb)
+		blkdev_trig_unlink_norelease(btl, btb);
+
+	if (btl->event_driven)
+		blkdev_trig_event_put();
+
+	mutex_unlock(&blkdev_trig_mutex);
+
+	/*
+	 * A concurrent check might still blink the LED; that must not happen
+	 * once the LED has been disassociated from the trigger.  Later runs
+	 * can't find the BTL, so waiting for the current run (if any) is
+	 * enough.  The BTL itself is freed after a grace period, in case an
+	 * RCU reader other than the delayed work still has it.
+	 */
+	flush_work(&blkdev_trig_work.work);
+	call_rcu(&btl->rcu, blkdev_trig_free_btl);
+}
+
+
+/*
+ *
+ *	Link-related attribute store functions
+ *
+ */
+
+/**
+ * blkdev_trig_find_btb() - Find the BTB of a linked block device.
+ * @btl:	The BTL that represents the LED
+ * @bdev:	The block device
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	The BTB, or &NULL if the block device is not linked to the LED.
+ */
+static struct blkdev_trig_bdev *blkdev_trig_find_btb(struct blkdev_trig_led *btl,
+						     struct block_device *bdev)
+{
+	struct blkdev_trig_bdev *btb;
+
+	btb = xa_load(&blkdev_trig_btbs, bdev->bd_dev);
+	if (btb == NULL || xa_load(&btb->linked_btls, btl->index) == NULL)
+		return NULL;
+
+	return btb;
+}
+
+/**
+ * blkdev_trig_find_btb_by_name() - Find the BTB of a linked block device by
+ *	name.
+ * @btl:	The BTL that represents the LED
+ * @name:	The kernel name of the block device (e.g. ``sda``)
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	The BTB, or &NULL if no such block device is linked to the LED.
+ */
+static struct blkdev_trig_bdev *
+blkdev_trig_find_btb_by_name(struct blkdev_trig_led *btl, const char *name)
+{
+	struct blkdev_trig_bdev *btb;
+
+	btb = rhashtable_lookup_fast(&blkdev_trig_names, name,
+				     blkdev_trig_names_params);
+	if (btb == NULL || xa_load(&btb->linked_btls, btl->index) == NULL)
+		return NULL;
+
+	return btb;
+}
+
+/**
+ * _blkdev_trig_link_bdevs() - Link block devices to an LED.
+ * @btl:	The BTL that represents the LED
+ * @bdevs:	The block devices
+ * @nr_bdevs:	The number of block devices
+ *
+ * If any of the block devices cannot be linked (e.g. because it is already
+ * linked to the LED), none of them are.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int _blkdev_trig_link_bdevs(struct blkdev_trig_led *btl,
+				   struct block_device **bdevs,
+				   unsigned int nr_bdevs)
+{
+	struct blkdev_trig_bdev *btb;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < nr_bdevs; ++i) {
+
+		btb = blkdev_trig_get_btb(bdevs[i]);
+		if (IS_ERR(btb)) {
+			err = PTR_ERR(btb);
+			break;
+		}
+
+		if (xa_load(&btb->linked_btls, btl->index) != NULL)
+			err = -EEXIST;
+		else
+			err = blkdev_trig_link(btl, btb);
+
+		if (err) {
+			blkdev_trig_put_btb(btb);
+			break;
+		}
+	}
+
+	/* Roll back any links that were created before the error */
+	if (err) {
+		while (i-- > 0)
+			blkdev_trig_unlink_norelease(btl,
+					blkdev_trig_find_btb(btl, bdevs[i]));
+	}
+
+	return err;
+}
+
+/**
+ * blkdev_trig_link_bdevs() - Link block devices (or, if the LED's
+ *	&link_slaves attribute is set, their physical members) to an LED.
+ * @btl:	The BTL that represents the LED
+ * @bdevs:	The block devices
+ * @nr_bdevs:	The number of block devices
+ *
+ * If any of the block devices cannot be linked, none of them are.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_link_bdevs(struct blkdev_trig_led *btl,
+				  struct block_device **bdevs,
+				  unsigned int nr_bdevs)
+{
+	struct block_device **members;
+	unsigned int nr_members;
+	int err;
+
+	if (!READ_ONCE(btl->link_slaves))
+		return _blkdev_trig_link_bdevs(btl, bdevs, nr_bdevs);
+
+	members = blkdev_trig_get_members(bdevs, nr_bdevs, &nr_members);
+	if (IS_ERR(members))
+		return PTR_ERR(members);
+
+	err = _blkdev_trig_link_bdevs(btl, members, nr_members);
+
+	blkdev_trig_put_members(members, nr_members);
+	return err;
+}
+
+/**
+ * blkdev_trig_link_by_id() - Link block devices, identified by name or device
+ *	number, to an LED.
+ * @btl:	The BTL that represents the LED
+ * @buf:	A list of block device names or numbers, separated by
+ *		whitespace and/or commas
+ * @count:	The number of characters in &buf
+ * @by_devt:	Whether &buf contains device numbers
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_link_by_id(struct blkdev_trig_led *btl, const char *buf,
+				  size_t count, bool by_devt)
+{
+	struct block_device **bdevs;
+	int nr_ids, i, err;
+	char **ids;
+
+	ids = blkdev_trig_split(buf, count, &nr_ids);
+	if (IS_ERR(ids))
+		return PTR_ERR(ids);
+
+	bdevs = kcalloc(nr_ids, sizeof(*bdevs), GFP_KERNEL);
+	if (bdevs == NULL) {
+		err = -ENOMEM;
+		goto exit_free_ids;
+	}
+
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		goto exit_free_bdevs;
+
+	for (i = 0; i < nr_ids; ++i) {
+
+		bdevs[i] = blkdev_trig_find_bdev(ids[i], by_devt);
+		if (IS_ERR(bdevs[i])) {
+			err = PTR_ERR(bdevs[i]);
+			break;
+		}
+	}
+
+	if (!err)
+		err = blkdev_trig_link_bdevs(btl, bdevs, nr_ids);
+
+	mutex_unlock(&blkdev_trig_mutex);
+
+	while (i-- > 0)
+		put_device(&bdevs[i]->bd_device);
+
+exit_free_bdevs:
+	kfree(bdevs);
+exit_free_ids:
+	argv_free(ids);
+	return err;
+}
+
+/**
+ * link_dev_by_path_store() - &link_dev_by_path device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &link_dev_by_path attribute (&dev_attr_link_dev_by_path)
+ * @buf:	The value written to the attribute, which should be a list of
+ *		paths to special files that represent block devices to be linked
+ *		to the LED (e.g. ``/dev/sda /dev/sdb``), separated by whitespace
+ *		and/or commas
+ * @count:	The number of characters in &buf
+ *
+ * All of the block devices are linked under a single acquisition of
+ * &blkdev_trig_mutex.  If any of them cannot be linked (e.g. because it is
+ * already linked to the LED), none of them are.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t link_dev_by_path_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	struct block_device **bdevs;
+	unsigned int nr_bdevs;
+	int err;
+
+	bdevs = blkdev_trig_get_bdevs(buf, count, &nr_bdevs);
+	if (IS_ERR(bdevs))
+		return PTR_ERR(bdevs);
+
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		goto exit_put_bdevs;
+
+	err = blkdev_trig_link_bdevs(btl, bdevs, nr_bdevs);
+
+	mutex_unlock(&blkdev_trig_mutex);
+exit_put_bdevs:
+	blkdev_trig_put_bdevs(bdevs, nr_bdevs);
+	return err ? : count;
+}
+
+/**
+ * unlink_dev_by_path_store() - &unlink_dev_by_path device attribute store
+ *	function.
+ * @dev:	The LED device
+ * @attr:	The &unlink_dev_by_path attribute (&dev_attr_unlink_dev_by_path)
+ * @buf:	The value written to the attribute, which should be a list of
+ *		paths to special files that represent block devices to be
+ *		unlinked from the LED (e.g. ``/dev/sda /dev/sdb``), separated
+ *		by whitespace and/or commas
+ * @count:	The number of characters in &buf
+ *
+ * If any of the block devices is not linked to the LED, none of them are
+ * unlinked.  If the LED's &link_slaves attribute is set, stacked block devices
+ * are expanded to their physical members, as when they were linked.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t unlink_dev_by_path_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	struct block_device **bdevs, **members;
+	unsigned int nr_bdevs, nr_members, i;
+	struct blkdev_trig_bdev *btb;
+	int err;
+
+	bdevs = blkdev_trig_get_bdevs(buf, count, &nr_bdevs);
+	if (IS_ERR(bdevs))
+		return PTR_ERR(bdevs);
+
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		goto exit_put_bdevs;
+
+	if (READ_ONCE(btl->link_slaves)) {
+		members = blkdev_trig_get_members(bdevs, nr_bdevs, &nr_members);
+		if (IS_ERR(members)) {
+			err = PTR_ERR(members);
+			goto exit_unlock;
+		}
+	} else {
+		members = bdevs;
+		nr_members = nr_bdevs;
+	}
+
+	for (i = 0; i < nr_members; ++i) {
+		if (blkdev_trig_find_btb(btl, members[i]) == NULL) {
+			err = -EUNATCH;  /* bdev isn't linked to this LED */
+			goto exit_put_members;
+		}
+	}
+
+	/* Look up each BTB again, in case a device was listed twice */
+	for (i = 0; i < nr_members; ++i) {
+		btb = blkdev_trig_find_btb(btl, members[i]);
+		if (btb != NULL)
+			blkdev_trig_unlink_norelease(btl, btb);
+	}
+
+exit_put_members:
+	if (members != bdevs)
+		blkdev_trig_put_members(members, nr_members);
+exit_unlock:
+	mutex_unlock(&blkdev_trig_mutex);
+exit_put_bdevs:
+	blkdev_trig_put_bdevs(bdevs, nr_bdevs);
+	return err ? : count;
+}
+
+/**
+ * unlink_dev_by_name_store() - &unlink_dev_by_name device attribute store
+ *	function.
+ * @dev:	The LED device
+ * @attr:	The &unlink_dev_by_name attribute (&dev_attr_unlink_dev_by_name)
+ * @buf:	The value written to the attribute, which should be a list of
+ *		kernel names of block devices to be unlinked from the LED (e.g.
+ *		``sda sdb``), separated by whitespace and/or commas
+ * @count:	The number of characters in &buf
+ *
+ * If any of the block devices is not linked to the LED, none of them are
+ * unlinked.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t unlink_dev_by_name_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	struct blkdev_trig_bdev *btb;
+	char **names;
+	int nr_names, i, err;
+
+	names = blkdev_trig_split(buf, count, &nr_names);
+	if (IS_ERR(names))
+		return PTR_ERR(names);
+
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		goto exit_free_names;
+
+	for (i = 0; i < nr_names; ++i) {
+		if (blkdev_trig_find_btb_by_name(btl, names[i]) == NULL) {
+			err = -EUNATCH;
+			goto exit_unlock;
+		}
+	}
+
+	/* Look up each BTB again, in case a device was listed twice */
+	for (i = 0; i < nr_names; ++i) {
+		btb = blkdev_trig_find_btb_by_name(btl, names[i]);
+		if (btb != NULL)
+			blkdev_trig_unlink_norelease(btl, btb);
+	}
+
+exit_unlock:
+	mutex_unlock(&blkdev_trig_mutex);
+exit_free_names:
+	argv_free(names);
+	return err ? : count;
+}
+
+/**
+ * link_dev_by_name_store() - &link_dev_by_name device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &link_dev_by_name attribute (&dev_attr_link_dev_by_name)
+ * @buf:	The value written to the attribute, which should be a list of
+ *		kernel names of block devices to be linked to the LED (e.g.
+ *		``sda sdb``), separated by whitespace and/or commas
+ * @count:	The number of characters in &buf
+ *
+ * Unlike &link_dev_by_path, this does not (usually) open the block devices, so
+ * it doesn't wake sleeping disks or wait for disks that are being reset.  See
+ * blkdev_trig_find_bdev().
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t link_dev_by_name_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return blkdev_trig_link_by_id(btl, buf, count, false) ? : count;
+}
+
+/**
+ * link_dev_by_devt_store() - &link_dev_by_devt device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &link_dev_by_devt attribute (&dev_attr_link_dev_by_devt)
+ * @buf:	The value written to the attribute, which should be a list of
+ *		device numbers of block devices to be linked to the LED (e.g.
+ *		``8:0 8:16``), separated by whitespace and/or commas
+ * @count:	The number of characters in &buf
+ *
+ * Like &link_dev_by_name, this does not (usually) open the block devices.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t link_dev_by_devt_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return blkdev_trig_link_by_id(btl, buf, count, true) ? : count;
+}
+
+/*
+ *
+ *	Hotplug linking rules
+ *
+ */
+
+#if IS_REACHABLE(CONFIG_SCSI)
+
+/**
+ * struct blkdev_trig_hotplug - A new (or newly bound) SCSI device.
+ * @work:	Work item that links the device's disk
+ * @sdev:	The SCSI device
+ */
+struct blkdev_trig_hotplug {
+	struct work_struct	work;
+	struct scsi_device	*sdev;
+};
+
+/* Ordered workqueue for hotplug work (drained on module exit) */
+static struct workqueue_struct *blkdev_trig_hotplug_wq;
+
+/* The SCSI bus (not exported; learned from the first SCSI device) */
+static const struct bus_type *blkdev_trig_scsi_bus;
+
+/* Protects blkdev_trig_scsi_bus */
+static DEFINE_MUTEX(blkdev_trig_scsi_bus_lock);
+
+/**
+ * blkdev_trig_sd_type() - Check whether a SCSI device is handled by the SCSI
+ *	disk driver.
+ * @sdev:	The SCSI device
+ *
+ * Context:	Any context.
+ * Return:	&true for disks, &false for CD-ROMs, tape drives, enclosures, etc.
+ */
+static bool blkdev_trig_sd_type(const struct scsi_device *sdev)
+{
+	switch (sdev->type) {
+	case TYPE_DISK:
+	case TYPE_MOD:
+	case TYPE_RBC:
+	case TYPE_ZBC:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * blkdev_trig_rule_match() - Check whether a SCSI device matches an LED's
+ *	hotplug linking rule.
+ * @btl:	The BTL that represents the LED
+ * @sdev:	The SCSI device
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&true if the device matches, &false if not.
+ */
+static bool blkdev_trig_rule_match(const struct blkdev_trig_led *btl,
+				   const struct scsi_device *sdev)
+{
+	const u64 hctl[4] = {
+		sdev->host->host_no, sdev->channel, sdev->id, sdev->lun
+	};
+	unsigned int i;
+
+	if (!blkdev_trig_sd_type(sdev))
+		return false;
+
+	for (i = 0; i < ARRAY_SIZE(hctl); ++i) {
+		if (btl->rule[i] != -1 && btl->rule[i] != hctl[i])
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * blkdev_trig_is_disk() - device_find_child() match function for the disk of
+ *	a SCSI device.
+ * @dev:	A child of the SCSI device
+ * @data:	Unused
+ *
+ * Context:	Process context.
+ * Return:	Non-zero if &dev is a whole disk.
+ */
+static int blkdev_trig_is_disk(struct device *dev, void *data)
+{
+	return dev->type == blkdev_trig_disk_type;
+}
+
+/**
+ * blkdev_trig_rule_link() - Link a SCSI device's disk to an LED.
+ * @btl:	The BTL that represents the LED
+ * @disk:	The disk's &bd_device
+ *
+ * A disk that is already linked to the LED is ignored.  SCSI disks are never
+ * stacked, so &link_slaves does not apply.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_rule_link(struct blkdev_trig_led *btl,
+				  struct device *disk)
+{
+	struct block_device *bdev = dev_to_bdev(disk);
+	int err;
+
+	err = _blkdev_trig_link_bdevs(btl, &bdev, 1);
+	if (err && err != -EEXIST)
+		dev_warn(btl->led->dev, "Failed to link %s: %d\n",
+			 dev_name(disk), err);
+}
+
+/**
+ * blkdev_trig_rule_link_all() - Link a SCSI device's disk to all LEDs with
+ *	matching rules.
+ * @sdev:	The SCSI device
+ *
+ * Does nothing if the disk has not yet been created.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_rule_link_all(struct scsi_device *sdev)
+{
+	struct blkdev_trig_led *btl;
+	struct device *disk = NULL;
+
+	list_for_each_entry (btl, &blkdev_trig_rule_btls, rule_node) {
+
+		if (!blkdev_trig_rule_match(btl, sdev))
+			continue;
+
+		if (disk == NULL) {
+			disk = device_find_child(&sdev->sdev_gendev, NULL,
+						 blkdev_trig_is_disk);
+			if (disk == NULL)
+				return;
+		}
+
+		blkdev_trig_rule_link(btl, disk);
+	}
+
+	put_device(disk);
+}
+
+/**
+ * blkdev_trig_hotplug_work() - Link a SCSI device's disk.
+ * @work:	&blkdev_trig_hotplug.work
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ */
+static void blkdev_trig_hotplug_work(struct work_struct *work)
+{
+	struct blkdev_trig_hotplug *hp;
+
+	hp = container_of(work, struct blkdev_trig_hotplug, work);
+
+	mutex_lock(&blkdev_trig_mutex);
+	blkdev_trig_rule_link_all(hp->sdev);
+	mutex_unlock(&blkdev_trig_mutex);
+
+	put_device(&hp->sdev->sdev_gendev);
+	kfree(hp);
+}
+
+/**
+ * blkdev_trig_hotplug_queue() - Queue hotplug work for a SCSI disk.
+ * @sdev:	The SCSI device
+ *
+ * Context:	Process context.
+ */
+static void blkdev_trig_hotplug_queue(struct scsi_device *sdev)
+{
+	struct blkdev_trig_hotplug *hp;
+
+	hp = kmalloc(sizeof(*hp), GFP_KERNEL);
+	if (hp == NULL)
+		return;  /* don't fail device addition */
+
+	INIT_WORK(&hp->work, blkdev_trig_hotplug_work);
+	hp->sdev = sdev;
+	get_device(&sdev->sdev_gendev);
+
+	queue_work(blkdev_trig_hotplug_wq, &hp->work);
+}
+
+/**
+ * blkdev_trig_scsi_notify() - SCSI bus notifier callback.
+ * @nb:		&blkdev_trig_scsi_nb
+ * @action:	The bus event
+ * @data:	The device
+ *
+ * The SCSI disk driver creates a device's disk when it probes the device,
+ * which may happen asynchronously, so the disk may not exist yet when the
+ * device is added.  It does exist once the driver is bound to the device.
+ *
+ * Context:	Process context.
+ * Return:	&NOTIFY_DONE.
+ */
+static int blkdev_trig_scsi_notify(struct notifier_block *nb,
+				   unsigned long action, void *data)
+{
+	struct device *dev = data;
+
+	if (action == BUS_NOTIFY_BOUND_DRIVER && scsi_is_sdev_device(dev) &&
+	    blkdev_trig_sd_type(to_scsi_device(dev)))
+		blkdev_trig_hotplug_queue(to_scsi_device(dev));
+
+	return NOTIFY_DONE;
+}
+
+/* Receives notifications of SCSI devices bound to drivers */
+static struct notifier_block blkdev_trig_scsi_nb = {
+	.notifier_call	= blkdev_trig_scsi_notify,
+};
+
+/**
+ * blkdev_trig_scsi_add() - Called when a SCSI device is added.
+ * @dev:	The SCSI device's class device
+ * @intf:	&blkdev_trig_scsi_intf
+ *
+ * The first call registers &blkdev_trig_scsi_nb on the device's bus, which
+ * isn't exported to modules.  The device's disk is linked now, if the disk
+ * driver has already been bound to it; otherwise, the bus notifier links it
+ * when the driver is bound.
+ *
+ * Context:	Process context.
+ * Return:	&0.
+ */
+static int blkdev_trig_scsi_add(struct device *dev,
+				struct class_interface *intf)
+{
+	struct scsi_device *sdev = to_scsi_device(dev->parent);
+
+	mutex_lock(&blkdev_trig_scsi_bus_lock);
+
+	if (blkdev_trig_scsi_bus == NULL &&
+	    bus_register_notifier(sdev->sdev_gendev.bus,
+				  &blkdev_trig_scsi_nb) == 0)
+		blkdev_trig_scsi_bus = sdev->sdev_gendev.bus;
+
+	mutex_unlock(&blkdev_trig_scsi_bus_lock);
+
+	if (blkdev_trig_sd_type(sdev))
+		blkdev_trig_hotplug_queue(sdev);
+
+	return 0;
+}
+
+/* Receives notifications of new SCSI devices */
+static struct class_interface blkdev_trig_scsi_intf = {
+	.add_dev	= blkdev_trig_scsi_add,
+};
+
+/* Is blkdev_trig_scsi_intf registered? */
+static bool blkdev_trig_scsi_registered;
+
+/**
+ * blkdev_trig_rule_scan() - class_for_each_device() callback that links the
+ *	disk of an existing SCSI device to an LED, if it matches the LED's rule.
+ * @dev:	The SCSI device's class device
+ * @data:	The BTL that represents the LED
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ * Return:	&0 (continue iterating).
+ */
+static int blkdev_trig_rule_scan(struct device *dev, void *data)
+{
+	struct scsi_device *sdev = to_scsi_device(dev->parent);
+	struct blkdev_trig_led *btl = data;
+	struct device *disk;
+
+	if (!blkdev_trig_rule_match(btl, sdev))
+		return 0;
+
+	disk = device_find_child(&sdev->sdev_gendev, NULL, blkdev_trig_is_disk);
+	if (disk != NULL) {
+		blkdev_trig_rule_link(btl, disk);
+		put_device(disk);
+	}
+
+	return 0;
+}
+
+/**
+ * blkdev_trig_hotplug_init() - Register for notifications of new SCSI devices.
+ *
+ * If registration fails, hotplug linking rules are not available.
+ */
+static void __init blkdev_trig_hotplug_init(void)
+{
+	blkdev_trig_hotplug_wq = alloc_ordered_workqueue("ledtrig-blkdev-hp", 0);
+	if (blkdev_trig_hotplug_wq == NULL)
+		goto error;
+
+	if (scsi_register_interface(&blkdev_trig_scsi_intf) != 0) {
+		destroy_workqueue(blkdev_trig_hotplug_wq);
+		goto error;
+	}
+
+	blkdev_trig_scsi_registered = true;
+	return;
+
+error:
+	pr_warn("hotplug linking rules not available\n");
+}
+
+/**
+ * blkdev_trig_hotplug_exit() - Stop handling new SCSI devices.
+ *
+ * Waits for any hotplug work to finish.
+ */
+static void blkdev_trig_hotplug_exit(void)
+{
+	if (!blkdev_trig_scsi_registered)
+		return;
+
+	scsi_unregister_interface(&blkdev_trig_scsi_intf);
+
+	if (blkdev_trig_scsi_bus != NULL)
+		bus_unregister_notifier(blkdev_trig_scsi_bus,
+					&blkdev_trig_scsi_nb);
+
+	destroy_workqueue(blkdev_trig_hotplug_wq);
+}
+
+/**
+ * link_scsi_hctl_show() - &link_scsi_hctl device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &link_scsi_hctl attribute (&dev_attr_link_scsi_hctl)
+ * @buf:	Output buffer
+ *
+ * Writes the LED's hotplug linking rule (or ``none``) to &buf.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t link_scsi_hctl_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned int i;
+	int len = 0;
+
+	mutex_lock(&blkdev_trig_mutex);
+
+	if (list_empty(&btl->rule_node)) {
+		len = sysfs_emit(buf, "none\n");
+		goto exit_unlock;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(btl->rule); ++i) {
+
+		if (btl->rule[i] == -1)
+			len += sysfs_emit_at(buf, len, "*");
+		else
+			len += sysfs_emit_at(buf, len, "%d", btl->rule[i]);
+
+		len += sysfs_emit_at(buf, len, i < 3 ? ":" : "\n");
+	}
 
 exit_unlock:
 	mutex_unlock(&blkdev_trig_mutex);
-exit_put_bdev:
-	blkdev_put(bdev, THIS_MODULE);
-	return err ? : count;
+	return len;
+}
+
+/**
+ * link_scsi_hctl_store() - &link_scsi_hctl device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &link_scsi_hctl attribute (&dev_attr_link_scsi_hctl)
+ * @buf:	The new rule, in ``<host>:<channel>:<target>:<lun>`` format,
+ *		where any field may be ``*`` to match any value (e.g.
+ *		``2:*:*:*``), or ``none`` to remove the rule
+ * @count:	The number of characters in &buf
+ *
+ * The disks of existing SCSI devices that match the rule are linked
+ * immediately.  Disks of matching devices that are added later are linked
+ * when the SCSI disk driver is bound to them.  Only devices of the types
+ * handled by the disk driver match.  Changing or removing the rule does not
+ * unlink any disks.
+ *
+ * Hotplug linking can miss disks that bind early.  The trigger can only watch
+ * for disk driver binds once it has seen a SCSI device, because the SCSI bus
+ * isn't exported to modules (see blkdev_trig_scsi_add()), and not at all if
+ * registering the bus notifier fails.  A disk whose driver binds before then
+ * is only linked if it already exists when its SCSI device is added or when
+ * the rule is written.  Writing the rule again links any disk that was missed.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t link_scsi_hctl_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	char *copy, *cur, *field;
+	int rule[4], i, err;
+
+	if (!blkdev_trig_scsi_registered)
+		return -EOPNOTSUPP;
+
+	if (sysfs_streq(buf, "none")) {
+		mutex_lock(&blkdev_trig_mutex);
+		list_del_init(&btl->rule_node);
+		mutex_unlock(&blkdev_trig_mutex);
+		return count;
+	}
+
+	copy = kmemdup_nul(buf, count, GFP_KERNEL);
+	if (copy == NULL)
+		return -ENOMEM;
+
+	cur = strim(copy);
+	err = 0;
+
+	for (i = 0; i < ARRAY_SIZE(rule); ++i) {
+
+		field = strsep(&cur, ":");
+		if (field == NULL) {
+			err = -EINVAL;
+			break;
+		}
+
+		if (strcmp(field, "*") == 0)
+			rule[i] = -1;
+		else if (kstrtoint(field, 10, &rule[i]) || rule[i] < 0)
+			err = -EINVAL;
+
+		if (err)
+			break;
+	}
+
+	kfree(copy);
+
+	if (err || cur != NULL)
+		return -EINVAL;
+
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		return err;
+
+	memcpy(btl->rule, rule, sizeof(btl->rule));
+
+	if (list_empty(&btl->rule_node))
+		list_add_tail(&btl->rule_node, &blkdev_trig_rule_btls);
+
+	class_for_each_device(blkdev_trig_scsi_intf.class, NULL, btl,
+			      blkdev_trig_rule_scan);
+
+	mutex_unlock(&blkdev_trig_mutex);
+	return count;
+}
+
+#else	/* IS_REACHABLE(CONFIG_SCSI) */
+
+static void __init blkdev_trig_hotplug_init(void)
+{
+}
+
+static void blkdev_trig_hotplug_exit(void)
+{
+}
+
+static ssize_t link_scsi_hctl_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "none\n");
+}
+
+static ssize_t link_scsi_hctl_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif	/* IS_REACHABLE(CONFIG_SCSI) */
+
+
+/*
+ *
+ *	Atomic attribute show & store functions
+ *
+ */
+
+/**
+ * blink_time_show() - &blink_time device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &blink_time attribute (&dev_attr_blink_time)
+ * @buf:	Output buffer
+ *
+ * Writes the value of &blkdev_trig_led.blink_msec to &buf.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t blink_time_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(btl->blink_msec));
+}
+
+/**
+ * blink_time_store() - &blink_time device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &blink_time attribute (&dev_attr_blink_time)
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
+ *
+ * Sets &blkdev_trig_led.blink_msec to the value in &buf.
+ *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t blink_time_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 0, &value);
+	if (err)
+		return err;
+
+	if (value < BLKDEV_TRIG_BLINK_MIN || value > BLKDEV_TRIG_BLINK_MAX)
+		return -ERANGE;
+
+	WRITE_ONCE(btl->blink_msec, value);
+	return count;
+}
+
+/**
+ * check_interval_show() - &check_interval device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &check_interval attribute (&dev_attr_check_interval)
+ * @buf:	Output buffer
+ *
+ * Writes the value of &blkdev_trig_led.check_interval (converted to
+ * milliseconds) to &buf.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t check_interval_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lld\n",
+			  ktime_to_ms(READ_ONCE(btl->check_interval)));
+}
+
+/**
+ * check_interval_store() - &check_interval device attribute store function
+ * @dev:	The LED device
+ * @attr:	The &check_interval attribute (&dev_attr_check_interval)
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
+ *
+ * Sets &blkdev_trig_led.check_interval to the value in &buf (after converting
+ * from milliseconds).
+ *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t check_interval_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct blkdev_trig_led *led = led_trigger_get_drvdata(dev);
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 0, &value);
+	if (err)
+		return err;
+
+	if (value < BLKDEV_TRIG_CHECK_MIN || value > BLKDEV_TRIG_CHECK_MAX)
+		return -ERANGE;
+
+	WRITE_ONCE(led->check_interval, ms_to_ktime(value));
+
+	return count;
+}
+
+/**
+ * max_check_interval_show() - &max_check_interval device attribute show
+ *	function.
+ * @dev:	The LED device
+ * @attr:	The &max_check_interval attribute (&dev_attr_max_check_interval)
+ * @buf:	Output buffer
+ *
+ * Writes the value of &blkdev_trig_led.max_interval (converted to
+ * milliseconds) to &buf.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t max_check_interval_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lld\n",
+			  ktime_to_ms(READ_ONCE(btl->max_interval)));
+}
+
+/**
+ * max_check_interval_store() - &max_check_interval device attribute store
+ *	function.
+ * @dev:	The LED device
+ * @attr:	The &max_check_interval attribute (&dev_attr_max_check_interval)
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
+ *
+ * Sets &blkdev_trig_led.max_interval to the value in &buf (after converting
+ * from milliseconds).  A value of &0 disables backoff of the check interval
+ * while the LED's block devices are idle; so does any value that is not
+ * greater than the LED's &check_interval.
+ *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t max_check_interval_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 0, &value);
+	if (err)
+		return err;
+
+	if (value != 0 &&
+	    (value < BLKDEV_TRIG_CHECK_MIN || value > BLKDEV_TRIG_CHECK_MAX))
+		return -ERANGE;
+
+	WRITE_ONCE(btl->max_interval, ms_to_ktime(value));
+
+	return count;
+}
+
+/**
+ * blkdev_trig_mode_show() - Helper for boolean attribute show functions.
+ * @led:	The LED
+ * @buf:	Output buffer
+ * @bit:	Which bit to show
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static int blkdev_trig_mode_show(const struct blkdev_trig_led *led, char *buf,
+				 enum stat_group bit)
+{
+	return sysfs_emit(buf,
+			  READ_ONCE(led->mode) & (1 << bit) ? "Y\n" : "N\n");
+}
+
+/**
+ * blkdev_trig_mode_store() - Helper for boolean attribute store functions.
+ * @led:	The LED
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
+ * @bit:	Which bit to set
+ *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
+ */
+static int blkdev_trig_mode_store(struct blkdev_trig_led *led,
+				  const char *buf, size_t count,
+				  enum stat_group bit)
+{
+	bool set;
+	int err;
+
+	err = kstrtobool(buf, &set);
+	if (err)
+		return err;
+
+	if (set)
+		set_bit(bit, &led->mode);
+	else
+		clear_bit(bit, &led->mode);
+
+	return count;
+}
+
+/**
+ * blink_on_read_show() - &blink_on_read device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_read attribute (&dev_attr_blink_on_read)
+ * @buf:	Output buffer
+ *
+ * Writes ``Y`` or ``N`` to &buf, depending on whether the &STAT_READ bit in
+ * &blkdev_trig_led.mode is set or cleared.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t blink_on_read_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
+				     buf, STAT_READ);
+}
+
+/**
+ * blink_on_read_store() - &blink_on_read device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_read attribute (&dev_attr_blink_on_read)
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
+ *
+ * Sets the &STAT_READ bit in &blkdev_trig_led.mode to the value in &buf
+ * (interpretted as a boolean).
+ *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t blink_on_read_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
+				      buf, count, STAT_READ);
+}
+
+/**
+ * blink_on_write_show() - &blink_on_write device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_write attribute (&dev_attr_blink_on_write)
+ * @buf:	Output buffer
+ *
+ * Writes ``Y`` or ``N`` to &buf, depending on whether the &STAT_WRITE bit in
+ * in &blkdev_trig_led.mode is set or cleared.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t blink_on_write_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
+				     buf, STAT_WRITE);
+}
+
+/**
+ * blink_on_write_store() - &blink_on_write device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_write attribute (&dev_attr_blink_on_write)
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
+ *
+ * Sets the &STAT_WRITE bit in &blkdev_trig_led.mode to the value in &buf
+ * (interpretted as a boolean).
+ *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t blink_on_write_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
+				      buf, count, STAT_WRITE);
 }
 
 /**
- * unlink_dev_by_name_store() - &unlink_dev_by_name device attribute store
- *	function.
+ * blink_on_flush_show() - &blink_on_flush device attribute show function.
  * @dev:	The LED device
- * @attr:	The &unlink_dev_by_name attribute (&dev_attr_unlink_dev_by_name)
- * @buf:	The value written to the attribute, which should be the kernel
- *		name of a block device to be unlinked from the LED (e.g.
- *		``sda``)
+ * @attr:	The &blink_on_flush attribute (&dev_attr_blink_on_flush)
+ * @buf:	Output buffer
+ *
+ * Writes ``Y`` or ``N`` to &buf, depending whether the &STAT_FLUSH bit in
+ * &blkdev_trig_led.mode is set or cleared.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t blink_on_flush_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
+				     buf, STAT_FLUSH);
+}
+
+/**
+ * blink_on_flush_store() - &blink_on_flush device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_flush attribute (&dev_attr_blink_on_flush)
+ * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Sets the &STAT_FLUSH bit in &blkdev_trig_led.mode to the value in &buf
+ * (interpretted as a boolean).
+ *
+ * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static ssize_t unlink_dev_by_name_store(struct device *dev,
-					struct device_attribute *attr,
-					const char *buf, size_t count)
+static ssize_t blink_on_flush_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
 {
-	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
-	struct blkdev_trig_bdev *btb;
-	unsigned long index;
-	int err;
-
-	err = mutex_lock_interruptible(&blkdev_trig_mutex);
-	if (err)
-		return err;
-
-	err = -EUNATCH;
-
-	xa_for_each (&btl->linked_btbs, index, btb) {
-
-		if (sysfs_streq(dev_name(&btb->bdev->bd_device), buf)) {
-			blkdev_trig_unlink_norelease(btl, btb);
-			err = 0;
-			break;
-		}
-	}
-
-	mutex_unlock(&blkdev_trig_mutex);
-	return err ? : count;
+	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
+				      buf, count, STAT_FLUSH);
 }
 
+/**
+ * blink_on_discard_show() - &blink_on_discard device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_discard attribute (&dev_attr_blink_on_discard)
+ * @buf:	Output buffer
+ *
+ * Writes ``Y`` or ``N`` to &buf, depending on whether the &STAT_DISCARD bit in
+ * &blkdev_trig_led.mode is set or cleared.
+ *
+ * Context:	Process context.
+ * Return:	The number of characters written to &buf.
+ */
+static ssize_t blink_on_discard_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
+				     buf, STAT_DISCARD);
+}
 
-/*
+/**
+ * blink_on_discard_store() - &blink_on_discard device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &blink_on_discard attribute (&dev_attr_blink_on_discard)
+ * @buf:	The new value (as written to the &sysfs attribute)
+ * @count:	The number of characters in &buf
  *
- *	Atomic attribute show & store functions
+ * Sets the &STAT_DISCARD bit in &blkdev_trig_led.mode to the value in &buf
+ * (interpretted as a boolean).
  *
+ * Context:	Process context.
+ * Return:	&count on success, negative &errno on error.
  */
+static ssize_t blink_on_discard_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
+				      buf, count, STAT_DISCARD);
+}
 
 /**
- * blink_time_show() - &blink_time device attribute show function.
+ * event_driven_show() - &event_driven device attribute show function.
  * @dev:	The LED device
- * @attr:	The &blink_time attribute (&dev_attr_blink_time)
+ * @attr:	The &event_driven attribute (&dev_attr_event_driven)
  * @buf:	Output buffer
  *
- * Writes the value of &blkdev_trig_led.blink_msec to &buf.
+ * Writes ``Y`` or ``N`` to &buf, depending on whether the LED is event-driven.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static ssize_t blink_time_show(struct device *dev,
-			       struct device_attribute *attr, char *buf)
+static ssize_t event_driven_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
 {
 	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
 
-	return sysfs_emit(buf, "%u\n", READ_ONCE(btl->blink_msec));
+	return sysfs_emit(buf, READ_ONCE(btl->event_driven) ? "Y\n" : "N\n");
 }
 
 /**
- * blink_time_store() - &blink_time device attribute store function.
+ * blkdev_trig_count_event_led() - Update the event-driven LED counts of an
+ *	LED's block devices.
+ * @btl:	The BTL that represents the LED
+ * @delta:	&1 if the LED has become event-driven, &-1 if it has become
+ *		polled
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_mutex.
+ */
+static void blkdev_trig_count_event_led(struct blkdev_trig_led *btl, int delta)
+{
+	struct blkdev_trig_bdev *btb;
+	unsigned long index;
+
+	xa_for_each (&btl->linked_btbs, index, btb)
+		WRITE_ONCE(btb->event_leds, btb->event_leds + delta);
+}
+
+/**
+ * event_driven_store() - &event_driven device attribute store function.
  * @dev:	The LED device
- * @attr:	The &blink_time attribute (&dev_attr_blink_time)
+ * @attr:	The &event_driven attribute (&dev_attr_event_driven)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Sets &blkdev_trig_led.blink_msec to the value in &buf.
+ * Switches the LED between event-driven mode and periodic polling, moving it
+ * out of or into the schedule of the delayed work as appropriate.
  *
- * Context:	Process context.
- * Return:	&count on success, negative &errno on error.
+ * Context:	Process context.  Takes and releases &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error (&-EOPNOTSUPP if
+ *		event-driven mode is not available).
  */
-static ssize_t blink_time_store(struct device *dev,
-				struct device_attribute *attr,
-				const char *buf, size_t count)
+static ssize_t event_driven_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
 {
 	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
-	unsigned int value;
+	bool set;
 	int err;
 
-	err = kstrtouint(buf, 0, &value);
+	err = kstrtobool(buf, &set);
 	if (err)
 		return err;
 
-	if (value < BLKDEV_TRIG_BLINK_MIN || value > BLKDEV_TRIG_BLINK_MAX)
-		return -ERANGE;
+	err = mutex_lock_interruptible(&blkdev_trig_mutex);
+	if (err)
+		return err;
 
-	WRITE_ONCE(btl->blink_msec, value);
-	return count;
+	if (set == btl->event_driven)
+		goto exit_unlock;
+
+	if (set) {
+		err = blkdev_trig_event_get();
+		if (err)
+			goto exit_unlock;
+		WRITE_ONCE(btl->event_driven, true);
+		blkdev_trig_count_event_led(btl, 1);
+		blkdev_trig_unsched_led(btl);
+	} else {
+		blkdev_trig_count_event_led(btl, -1);
+		WRITE_ONCE(btl->event_driven, false);
+		blkdev_trig_event_put();
+		if (!xa_empty(&btl->linked_btbs))
+			blkdev_trig_sched_led(btl);
+	}
+
+exit_unlock:
+	mutex_unlock(&blkdev_trig_mutex);
+	return err ? : count;
 }
 
 /**
- * check_interval_show() - &check_interval device attribute show function.
+ * intensity_mode_show() - &intensity_mode device attribute show function.
  * @dev:	The LED device
- * @attr:	The &check_interval attribute (&dev_attr_check_interval)
+ * @attr:	The &intensity_mode attribute (&dev_attr_intensity_mode)
  * @buf:	Output buffer
  *
- * Writes the value of &blkdev_trig_led.check_jiffies (converted to
- * milliseconds) to &buf.
+ * Writes ``Y`` or ``N`` to &buf, depending on whether the LED is in intensity
+ * mode.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static ssize_t check_interval_show(struct device *dev,
+static ssize_t intensity_mode_show(struct device *dev,
 				   struct device_attribute *attr, char *buf)
 {
-	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
 
-	return sysfs_emit(buf, "%u\n",
-			  jiffies_to_msecs(READ_ONCE(btl->check_jiffies)));
+	return sysfs_emit(buf, READ_ONCE(btl->intensity_mode) ? "Y\n" : "N\n");
 }
 
 /**
- * check_interval_store() - &check_interval device attribute store function
+ * intensity_mode_store() - &intensity_mode device attribute store function.
  * @dev:	The LED device
- * @attr:	The &check_interval attribute (&dev_attr_check_interval)
+ * @attr:	The &intensity_mode attribute (&dev_attr_intensity_mode)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Sets &blkdev_trig_led.check_jiffies to the value in &buf (after converting
- * from milliseconds).
+ * Sets &blkdev_trig_led.intensity_mode to the value in &buf (interpretted as a
+ * boolean).  The LED is turned off when intensity mode is disabled, since it
+ * may have been left at a partial brightness.  (Event-driven LEDs always
+ * simply blink.)  A check that is running concurrently may still set a partial
+ * brightness; the LED's next check turns it off.
+ *
+ * On LED drivers whose dimmed LEDs share a single PWM channel (e.g. the
+ * PCA9532), the brightness of an LED in intensity mode isn't independent of
+ * the other dimmed LEDs on the same chip; see blkdev_trig_intensity().
  *
  * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static ssize_t check_interval_store(struct device *dev,
+static ssize_t intensity_mode_store(struct device *dev,
 				    struct device_attribute *attr,
 				    const char *buf, size_t count)
 {
-	struct blkdev_trig_led *led = led_trigger_get_drvdata(dev);
-	unsigned int value;
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	bool set;
 	int err;
 
-	err = kstrtouint(buf, 0, &value);
+	err = kstrtobool(buf, &set);
 	if (err)
 		return err;
 
-	if (value < BLKDEV_TRIG_CHECK_MIN || value > BLKDEV_TRIG_CHECK_MAX)
-		return -ERANGE;
+	WRITE_ONCE(btl->intensity_mode, set);
 
-	WRITE_ONCE(led->check_jiffies, msecs_to_jiffies(value));
+	if (!set) {
+		led_set_brightness(btl->led, LED_OFF);
+		WRITE_ONCE(btl->intensity_level, LED_OFF);
+	}
 
 	return count;
 }
 
 /**
- * blkdev_trig_mode_show() - Helper for boolean attribute show functions.
- * @led:	The LED
+ * intensity_full_show() - &intensity_full device attribute show function.
+ * @dev:	The LED device
+ * @attr:	The &intensity_full attribute (&dev_attr_intensity_full)
  * @buf:	Output buffer
- * @bit:	Which bit to show
+ *
+ * Writes the value of &blkdev_trig_led.intensity_full to &buf.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static int blkdev_trig_mode_show(const struct blkdev_trig_led *led, char *buf,
-				 enum stat_group bit)
+static ssize_t intensity_full_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
 {
-	return sysfs_emit(buf,
-			  READ_ONCE(led->mode) & (1 << bit) ? "Y\n" : "N\n");
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(btl->intensity_full));
 }
 
 /**
- * blkdev_trig_mode_store() - Helper for boolean attribute store functions.
- * @led:	The LED
+ * intensity_full_store() - &intensity_full device attribute store function.
+ * @dev:	The LED device
+ * @attr:	The &intensity_full attribute (&dev_attr_intensity_full)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
- * @bit:	Which bit to set
+ *
+ * Sets &blkdev_trig_led.intensity_full to the value in &buf.
  *
  * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static int blkdev_trig_mode_store(struct blkdev_trig_led *led,
-				  const char *buf, size_t count,
-				  enum stat_group bit)
+static ssize_t intensity_full_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
 {
-	bool set;
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned int value;
 	int err;
 
-	err = kstrtobool(buf, &set);
+	err = kstrtouint(buf, 0, &value);
 	if (err)
 		return err;
 
-	if (set)
-		set_bit(bit, &led->mode);
-	else
-		clear_bit(bit, &led->mode);
+	if (value < BLKDEV_TRIG_FULL_MIN || value > BLKDEV_TRIG_FULL_MAX)
+		return -ERANGE;
 
+	WRITE_ONCE(btl->intensity_full, value);
 	return count;
 }
 
 /**
- * blink_on_read_show() - &blink_on_read device attribute show function.
+ * blink_min_ios_show() - &blink_min_ios device attribute show function.
  * @dev:	The LED device
- * @attr:	The &blink_on_read attribute (&dev_attr_blink_on_read)
+ * @attr:	The &blink_min_ios attribute (&dev_attr_blink_min_ios)
  * @buf:	Output buffer
  *
- * Writes ``Y`` or ``N`` to &buf, depending on whether the &STAT_READ bit in
- * &blkdev_trig_led.mode is set or cleared.
+ * Writes the value of &blkdev_trig_led.min_ios to &buf.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static ssize_t blink_on_read_show(struct device *dev,
+static ssize_t blink_min_ios_show(struct device *dev,
 				  struct device_attribute *attr, char *buf)
 {
-	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
-				     buf, STAT_READ);
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(btl->min_ios));
 }
 
 /**
- * blink_on_read_store() - &blink_on_read device attribute store function.
+ * blink_min_ios_store() - &blink_min_ios device attribute store function.
  * @dev:	The LED device
- * @attr:	The &blink_on_read attribute (&dev_attr_blink_on_read)
+ * @attr:	The &blink_min_ios attribute (&dev_attr_blink_min_ios)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Sets the &STAT_READ bit in &blkdev_trig_led.mode to the value in &buf
- * (interpretted as a boolean).
+ * Sets &blkdev_trig_led.min_ios to the value in &buf.  The LED only blinks if
+ * at least that many operations (of the types selected by the &blink_on_*
+ * attributes) have occurred on its block devices since the last check.  &0
+ * disables the threshold.  Thresholds don't apply to event-driven LEDs or in
+ * intensity mode.  Values above &BLKDEV_TRIG_MIN_IOS_MAX are rejected.  A
+ * threshold that the block devices can't reach within the LED's check interval
+ * is allowed, but keeps the LED from blinking at all.
  *
  * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static ssize_t blink_on_read_store(struct device *dev,
+static ssize_t blink_min_ios_store(struct device *dev,
 				   struct device_attribute *attr,
 				   const char *buf, size_t count)
 {
-	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
-				      buf, count, STAT_READ);
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 0, &value);
+	if (err)
+		return err;
+
+	if (value > BLKDEV_TRIG_MIN_IOS_MAX)
+		return -ERANGE;
+
+	WRITE_ONCE(btl->min_ios, value);
+	return count;
 }
 
 /**
- * blink_on_write_show() - &blink_on_write device attribute show function.
+ * blink_min_sectors_show() - &blink_min_sectors device attribute show function.
  * @dev:	The LED device
- * @attr:	The &blink_on_write attribute (&dev_attr_blink_on_write)
+ * @attr:	The &blink_min_sectors attribute (&dev_attr_blink_min_sectors)
  * @buf:	Output buffer
  *
- * Writes ``Y`` or ``N`` to &buf, depending on whether the &STAT_WRITE bit in
- * in &blkdev_trig_led.mode is set or cleared.
+ * Writes the value of &blkdev_trig_led.min_sectors to &buf.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static ssize_t blink_on_write_show(struct device *dev,
-				   struct device_attribute *attr, char *buf)
+static ssize_t blink_min_sectors_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
 {
-	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
-				     buf, STAT_WRITE);
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(btl->min_sectors));
 }
 
 /**
- * blink_on_write_store() - &blink_on_write device attribute store function.
+ * blink_min_sectors_store() - &blink_min_sectors device attribute store function.
  * @dev:	The LED device
- * @attr:	The &blink_on_write attribute (&dev_attr_blink_on_write)
+ * @attr:	The &blink_min_sectors attribute (&dev_attr_blink_min_sectors)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Sets the &STAT_WRITE bit in &blkdev_trig_led.mode to the value in &buf
- * (interpretted as a boolean).
+ * Sets &blkdev_trig_led.min_sectors to the value in &buf.  The LED only blinks if
+ * at least that many sectors (of the types selected by the &blink_on_*
+ * attributes) have occurred on its block devices since the last check.  &0
+ * disables the threshold.  Thresholds don't apply to event-driven LEDs or in
+ * intensity mode.  Values above &BLKDEV_TRIG_MIN_SECTORS_MAX are rejected.  A
+ * threshold that the block devices can't reach within the LED's check interval
+ * is allowed, but keeps the LED from blinking at all.
  *
  * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static ssize_t blink_on_write_store(struct device *dev,
-				    struct device_attribute *attr,
-				    const char *buf, size_t count)
+static ssize_t blink_min_sectors_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
 {
-	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
-				      buf, count, STAT_WRITE);
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 0, &value);
+	if (err)
+		return err;
+
+	if (value > BLKDEV_TRIG_MIN_SECTORS_MAX)
+		return -ERANGE;
+
+	WRITE_ONCE(btl->min_sectors, value);
+	return count;
 }
 
 /**
- * blink_on_flush_show() - &blink_on_flush device attribute show function.
+ * hw_blink_show() - &hw_blink device attribute show function.
  * @dev:	The LED device
- * @attr:	The &blink_on_flush attribute (&dev_attr_blink_on_flush)
+ * @attr:	The &hw_blink attribute (&dev_attr_hw_blink)
  * @buf:	Output buffer
  *
- * Writes ``Y`` or ``N`` to &buf, depending whether the &STAT_FLUSH bit in
- * &blkdev_trig_led.mode is set or cleared.
+ * Writes ``Y`` or ``N`` to &buf, depending on whether sustained activity is
+ * shown by hardware blinking.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static ssize_t blink_on_flush_show(struct device *dev,
-				   struct device_attribute *attr, char *buf)
+static ssize_t hw_blink_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
 {
-	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
-				     buf, STAT_FLUSH);
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, READ_ONCE(btl->hw_blink) ? "Y\n" : "N\n");
 }
 
 /**
- * blink_on_flush_store() - &blink_on_flush device attribute store function.
+ * hw_blink_store() - &hw_blink device attribute store function.
  * @dev:	The LED device
- * @attr:	The &blink_on_flush attribute (&dev_attr_blink_on_flush)
+ * @attr:	The &hw_blink attribute (&dev_attr_hw_blink)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Sets the &STAT_FLUSH bit in &blkdev_trig_led.mode to the value in &buf
- * (interpretted as a boolean).
+ * Sets &blkdev_trig_led.hw_blink to the value in &buf (interpretted as a
+ * boolean).  Has no effect if the LED's driver doesn't support hardware
+ * blinking.  Hardware blinking runs at the driver's default rate, regardless
+ * of &blink_time.
  *
  * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static ssize_t blink_on_flush_store(struct device *dev,
-				    struct device_attribute *attr,
-				    const char *buf, size_t count)
+static ssize_t hw_blink_store(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
 {
-	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
-				      buf, count, STAT_FLUSH);
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	bool set;
+	int err;
+
+	err = kstrtobool(buf, &set);
+	if (err)
+		return err;
+
+	WRITE_ONCE(btl->hw_blink, set);
+	return count;
 }
 
 /**
- * blink_on_discard_show() - &blink_on_discard device attribute show function.
+ * link_slaves_show() - &link_slaves device attribute show function.
  * @dev:	The LED device
- * @attr:	The &blink_on_discard attribute (&dev_attr_blink_on_discard)
+ * @attr:	The &link_slaves attribute (&dev_attr_link_slaves)
  * @buf:	Output buffer
  *
- * Writes ``Y`` or ``N`` to &buf, depending on whether the &STAT_DISCARD bit in
- * &blkdev_trig_led.mode is set or cleared.
+ * Writes ``Y`` or ``N`` to &buf, depending on whether linking a stacked block
+ * device to the LED links its physical members instead.
  *
  * Context:	Process context.
  * Return:	The number of characters written to &buf.
  */
-static ssize_t blink_on_discard_show(struct device *dev,
-				     struct device_attribute *attr, char *buf)
+static ssize_t link_slaves_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
 {
-	return blkdev_trig_mode_show(led_trigger_get_drvdata(dev),
-				     buf, STAT_DISCARD);
+	const struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+
+	return sysfs_emit(buf, READ_ONCE(btl->link_slaves) ? "Y\n" : "N\n");
 }
 
 /**
- * blink_on_discard_store() - &blink_on_discard device attribute store function.
+ * link_slaves_store() - &link_slaves device attribute store function.
  * @dev:	The LED device
- * @attr:	The &blink_on_discard attribute (&dev_attr_blink_on_discard)
+ * @attr:	The &link_slaves attribute (&dev_attr_link_slaves)
  * @buf:	The new value (as written to the &sysfs attribute)
  * @count:	The number of characters in &buf
  *
- * Sets the &STAT_DISCARD bit in &blkdev_trig_led.mode to the value in &buf
- * (interpretted as a boolean).
+ * Sets &blkdev_trig_led.link_slaves to the value in &buf (interpretted as a
+ * boolean).  Only affects subsequent writes to the LED's link and unlink
+ * attributes; block devices that are already linked are unchanged.
  *
  * Context:	Process context.
  * Return:	&count on success, negative &errno on error.
  */
-static ssize_t blink_on_discard_store(struct device *dev,
-				      struct device_attribute *attr,
-				      const char *buf, size_t count)
+static ssize_t link_slaves_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
 {
-	return blkdev_trig_mode_store(led_trigger_get_drvdata(dev),
-				      buf, count, STAT_DISCARD);
+	struct blkdev_trig_led *btl = led_trigger_get_drvdata(dev);
+	bool set;
+	int err;
+
+	err = kstrtobool(buf, &set);
+	if (err)
+		return err;
+
+	WRITE_ONCE(btl->link_slaves, set);
+	return count;
 }
 
 /* Device attributes */
 static DEVICE_ATTR_WO(link_dev_by_path);
+static DEVICE_ATTR_WO(link_dev_by_name);
+static DEVICE_ATTR_WO(link_dev_by_devt);
 static DEVICE_ATTR_WO(unlink_dev_by_path);
 static DEVICE_ATTR_WO(unlink_dev_by_name);
 static DEVICE_ATTR_RW(blink_time);
 static DEVICE_ATTR_RW(check_interval);
+static DEVICE_ATTR_RW(max_check_interval);
 static DEVICE_ATTR_RW(blink_on_read);
 static DEVICE_ATTR_RW(blink_on_write);
 static DEVICE_ATTR_RW(blink_on_flush);
 static DEVICE_ATTR_RW(blink_on_discard);
+static DEVICE_ATTR_RW(event_driven);
+static DEVICE_ATTR_RW(intensity_mode);
+static DEVICE_ATTR_RW(intensity_full);
+static DEVICE_ATTR_RW(blink_min_ios);
+static DEVICE_ATTR_RW(blink_min_sectors);
+static DEVICE_ATTR_RW(hw_blink);
+static DEVICE_ATTR_RW(link_slaves);
+static DEVICE_ATTR_RW(link_scsi_hctl);
 
 /* Device attributes in LED directory (/sys/class/leds/<led>/...) */
 static struct attribute *blkdev_trig_attrs[] = {
 	&dev_attr_link_dev_by_path.attr,
+	&dev_attr_link_dev_by_name.attr,
+	&dev_attr_link_dev_by_devt.attr,
 	&dev_attr_unlink_dev_by_path.attr,
 	&dev_attr_unlink_dev_by_name.attr,
 	&dev_attr_blink_time.attr,
 	&dev_attr_check_interval.attr,
+	&dev_attr_max_check_interval.attr,
 	&dev_attr_blink_on_read.attr,
 	&dev_attr_blink_on_write.attr,
 	&dev_attr_blink_on_flush.attr,
 	&dev_attr_blink_on_discard.attr,
+	&dev_attr_event_driven.attr,
+	&dev_attr_intensity_mode.attr,
+	&dev_attr_intensity_full.attr,
+	&dev_attr_blink_min_ios.attr,
+	&dev_attr_blink_min_sectors.attr,
+	&dev_attr_hw_blink.attr,
+	&dev_attr_link_slaves.attr,
+	&dev_attr_link_scsi_hctl.attr,
 	NULL
 };
 
@@ -1189,27 +4857,539 @@ static struct led_trigger blkdev_trig_trigger = {
 	.groups		= blkdev_trig_attr_groups,
 };
 
+
+/*
+ *
+ *	debugfs benchmarking harness
+ *
+ */
+
+#ifdef CONFIG_DEBUG_FS
+
+/* Maximum number of dummy LEDs */
+#define BLKDEV_TRIG_BENCH_MAX	1024
+
+/**
+ * struct blkdev_trig_bench_led - A dummy LED for benchmarking.
+ * @cdev:	The LED device
+ * @name:	The LED's name
+ */
+struct blkdev_trig_bench_led {
+	struct led_classdev	cdev;
+	char			name[24];
+};
+
+/* The trigger's debugfs directory */
+static struct dentry *blkdev_trig_debugfs;
+
+/* Protects the dummy LEDs */
+static DEFINE_MUTEX(blkdev_trig_bench_mutex);
+
+/* Dummy LEDs and number of dummy LEDs */
+static struct blkdev_trig_bench_led *blkdev_trig_bench_leds;
+static unsigned int blkdev_trig_bench_count;
+
+/**
+ * blkdev_trig_bench_set_brightness() - Set the brightness of a dummy LED.
+ * @cdev:	The LED device
+ * @value:	The brightness (ignored)
+ *
+ * Context:	Any context.
+ */
+static void blkdev_trig_bench_set_brightness(struct led_classdev *cdev,
+					     enum led_brightness value)
+{
+}
+
+/**
+ * blkdev_trig_bench_remove() - Remove all dummy LEDs.
+ *
+ * Context:	Process context.  Caller must hold &blkdev_trig_bench_mutex.
+ */
+static void blkdev_trig_bench_remove(void)
+{
+	while (blkdev_trig_bench_count > 0) {
+		--blkdev_trig_bench_count;
+		led_classdev_unregister(
+			&blkdev_trig_bench_leds[blkdev_trig_bench_count].cdev);
+	}
+
+	kfree(blkdev_trig_bench_leds);
+	blkdev_trig_bench_leds = NULL;
+}
+
+/**
+ * blkdev_trig_bench_leds_get() - Get the number of dummy LEDs.
+ * @data:	Unused
+ * @val:	Output
+ *
+ * Context:	Process context.
+ * Return:	&0.
+ */
+static int blkdev_trig_bench_leds_get(void *data, u64 *val)
+{
+	*val = READ_ONCE(blkdev_trig_bench_count);
+	return 0;
+}
+
+/**
+ * blkdev_trig_bench_leds_set() - Replace the dummy LEDs.
+ * @data:	Unused
+ * @val:	Number of dummy LEDs to create
+ *
+ * Any existing dummy LEDs are removed first.  The new LEDs use the ``blkdev``
+ * trigger by default.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_bench_mutex.
+ * Return:	&0 on success, negative &errno on error.
+ */
+static int blkdev_trig_bench_leds_set(void *data, u64 val)
+{
+	struct blkdev_trig_bench_led *bench;
+	int err = 0;
+
+	if (val > BLKDEV_TRIG_BENCH_MAX)
+		return -ERANGE;
+
+	mutex_lock(&blkdev_trig_bench_mutex);
+
+	blkdev_trig_bench_remove();
+
+	if (val == 0)
+		goto exit_unlock;
+
+	blkdev_trig_bench_leds = kcalloc(val, sizeof(*blkdev_trig_bench_leds),
+					 GFP_KERNEL);
+	if (blkdev_trig_bench_leds == NULL) {
+		err = -ENOMEM;
+		goto exit_unlock;
+	}
+
+	while (blkdev_trig_bench_count < val) {
+
+		bench = &blkdev_trig_bench_leds[blkdev_trig_bench_count];
+
+		snprintf(bench->name, sizeof(bench->name), "blkdev-bench:%u",
+			 blkdev_trig_bench_count);
+		bench->cdev.name = bench->name;
+		bench->cdev.max_brightness = LED_ON;
+		bench->cdev.brightness_set = blkdev_trig_bench_set_brightness;
+		bench->cdev.default_trigger = blkdev_trig_trigger.name;
+
+		err = led_classdev_register(NULL, &bench->cdev);
+		if (err) {
+			blkdev_trig_bench_remove();
+			goto exit_unlock;
+		}
+
+		++blkdev_trig_bench_count;
+	}
+
+exit_unlock:
+	mutex_unlock(&blkdev_trig_bench_mutex);
+	return err;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(blkdev_trig_bench_leds_fops,
+			 blkdev_trig_bench_leds_get, blkdev_trig_bench_leds_set,
+			 "%llu\n");
+
+/**
+ * blkdev_trig_bench_link_write() - Link every dummy LED to block devices.
+ * @file:	The &debugfs file
+ * @ubuf:	A list of block device names, as for &link_dev_by_name
+ * @count:	The number of characters in &ubuf
+ * @ppos:	Unused
+ *
+ * Dummy LEDs that no longer use the ``blkdev`` trigger are skipped.  On error,
+ * the LEDs that have already been linked keep their links.
+ *
+ * Context:	Process context.  Takes and releases &blkdev_trig_bench_mutex
+ *		and (once per LED) &blkdev_trig_mutex.
+ * Return:	&count on success, negative &errno on error.
+ */
+static ssize_t blkdev_trig_bench_link_write(struct file *file,
+					    const char __user *ubuf,
+					    size_t count, loff_t *ppos)
+{
+	struct blkdev_trig_bench_led *bench;
+	unsigned int i;
+	int err = 0;
+	char *buf;
+
+	buf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	mutex_lock(&blkdev_trig_bench_mutex);
+
+	for (i = 0; i < blkdev_trig_bench_count && !err; ++i) {
+
+		bench = &blkdev_trig_bench_leds[i];
+
+		down_read(&bench->cdev.trigger_lock);
+
+		if (bench->cdev.trigger == &blkdev_trig_trigger)
+			err = blkdev_trig_link_by_id(
+					led_get_trigger_data(&bench->cdev),
+					buf, count, false);
+
+		up_read(&bench->cdev.trigger_lock);
+		cond_resched();
+	}
+
+	mutex_unlock(&blkdev_trig_bench_mutex);
+
+	kfree(buf);
+	return err ? : count;
+}
+
+static const struct file_operations blkdev_trig_bench_link_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= blkdev_trig_bench_link_write,
+	.llseek	= noop_llseek,
+};
+
+/**
+ * blkdev_trig_stats_reset_set() - Request a reset of the statistics.
+ * @data:	Unused
+ * @val:	Ignored
+ *
+ * The reset is performed by the next run of the delayed work, so that it
+ * doesn't race with the work's updates.
+ *
+ * Context:	Process context.
+ * Return:	&0.
+ */
+static int blkdev_trig_stats_reset_set(void *data, u64 val)
+{
+	set_bit(0, &blkdev_trig_stats_reset);
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(blkdev_trig_stats_reset_fops, NULL,
+			 blkdev_trig_stats_reset_set, "%llu\n");
+
+/**
+ * blkdev_trig_hist_show() - Show a histogram.
+ * @s:		The &seq_file
+ * @name:	Name of the histogram
+ * @unit:	Unit of the histogram's samples
+ * @hist:	The histogram
+ */
+static void blkdev_trig_hist_show(struct seq_file *s, const char *name,
+				  const char *unit,
+				  const struct blkdev_trig_hist *hist)
+{
+	unsigned int i;
+
+	seq_printf(s, "%s: samples %lu, avg %llu %s, max %llu %s\n",
+		   name, hist->samples,
+		   hist->samples ? div_u64(hist->total, hist->samples) : 0,
+		   unit, hist->max, unit);
+
+	for (i = 0; i < BLKDEV_TRIG_HIST_BUCKETS; ++i) {
+
+		if (hist->count[i] == 0)
+			continue;
+
+		if (i == 0)
+			seq_puts(s, "  0");
+		else if (i == BLKDEV_TRIG_HIST_BUCKETS - 1)
+			seq_printf(s, "  >= %llu", 1ULL << (i - 1));
+		else
+			seq_printf(s, "  %llu - %llu", 1ULL << (i - 1),
+				   (1ULL << i) - 1);
+
+		seq_printf(s, " %s: %lu\n", unit, hist->count[i]);
+	}
+}
+
+/**
+ * blkdev_trig_stats_show() - Show the statistics.
+ * @s:		The &seq_file
+ * @unused:	Unused
+ *
+ * Values are read without synchronization with the delayed work, so they may
+ * be slightly inconsistent with each other.
+ *
+ * Context:	Process context.
+ * Return:	&0.
+ */
+static int blkdev_trig_stats_show(struct seq_file *s, void *unused)
+{
+	const struct blkdev_trig_stats *stats = &blkdev_trig_stats;
+	unsigned long reads;
+	u64 elapsed_ms;
+
+	reads = atomic_long_read(&stats->reads);
+	elapsed_ms = div_u64(ktime_get_ns() - stats->start_ns, NSEC_PER_MSEC);
+
+	seq_printf(s, "enabled: %d\n", READ_ONCE(blkdev_trig_stats_enabled));
+	seq_printf(s, "elapsed: %llu ms\n", elapsed_ms);
+	seq_printf(s, "runs: %lu (%lu kicked by events)\n",
+		   stats->runs, stats->kicked);
+	seq_printf(s, "leds checked: %lu (%lu deferred)\n", stats->leds,
+		   stats->deferred);
+	seq_printf(s, "blinks: %lu\n", stats->blinks);
+	seq_printf(s, "btb updates: %lu (%llu/s)\n", reads,
+		   elapsed_ms ? div64_u64((u64)reads * MSEC_PER_SEC, elapsed_ms)
+			      : 0);
+	seq_printf(s, "btb updates skipped: %lu\n",
+		   atomic_long_read(&stats->skips));
+
+	blkdev_trig_hist_show(s, "run time", "ns", &stats->tick_ns);
+	blkdev_trig_hist_show(s, "lateness", "us", &stats->late_us);
+	blkdev_trig_hist_show(s, "event blink latency", "us",
+			      &stats->blink_us);
+
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(blkdev_trig_stats);
+
+/**
+ * blkdev_trig_age_ms() - Get the age of a timestamp in milliseconds.
+ * @now:	The current time
+ * @t:		The timestamp (&0 if the event has never occurred)
+ *
+ * Context:	Any context.
+ * Return:	Milliseconds since &t, or &-1 if &t is &0.
+ */
+static s64 blkdev_trig_age_ms(ktime_t now, ktime_t t)
+{
+	return t == 0 ? -1 : ktime_ms_delta(now, t);
+}
+
+/**
+ * blkdev_trig_devices_show() - Show the activity counters of all linked block
+ *	devices.
+ * @s:		The &seq_file
+ * @unused:	Unused
+ *
+ * Writes one line per linked block device, with the operation and sector
+ * counters (reads, writes, discards and flushes) as of the trigger's most
+ * recent sample, the age (in milliseconds) of the most recent activity of each
+ * type (&-1 if none has been seen since the device was linked), and the age of
+ * the sample itself.  A monitoring agent can compute activity rates from
+ * successive reads of this single file, without reading the per-CPU
+ * statistics of every disk itself.
+ *
+ * Context:	Process context.  Takes and releases the RCU read lock.
+ * Return:	&0.
+ */
+static int blkdev_trig_devices_show(struct seq_file *s, void *unused)
+{
+	const struct blkdev_trig_bdev *btb;
+	unsigned long index;
+	enum stat_group i;
+	ktime_t now;
+
+	seq_puts(s, "# dev name reads writes discards flushes read_sectors write_sectors discard_sectors read_ms write_ms discard_ms flush_ms sample_ms\n");
+
+	now = ktime_get();
+
+	rcu_read_lock();
+
+	xa_for_each (&blkdev_trig_btbs, index, btb) {
+
+		seq_printf(s, "%u:%u %pg", MAJOR(btb->bdev->bd_dev),
+			   MINOR(btb->bdev->bd_dev), btb->bdev);
+
+		for (i = STAT_READ; i <= STAT_FLUSH; ++i)
+			seq_printf(s, " %lu", READ_ONCE(btb->ios[i]));
+
+		for (i = STAT_READ; i <= STAT_DISCARD; ++i)
+			seq_printf(s, " %lu", READ_ONCE(btb->sectors[i]));
+
+		for (i = STAT_READ; i <= STAT_FLUSH; ++i)
+			seq_printf(s, " %lld", blkdev_trig_age_ms(now,
+					READ_ONCE(btb->last_activity[i])));
+
+		seq_printf(s, " %lld\n", blkdev_trig_age_ms(now,
+				READ_ONCE(btb->last_checked)));
+	}
+
+	rcu_read_unlock();
+	return 0;
+}
+
+DEFINE_SHOW_ATTRIBUTE(blkdev_trig_devices);
+
+/**
+ * blkdev_trig_debugfs_init() - Create the trigger's &debugfs files.
+ */
+static void __init blkdev_trig_debugfs_init(void)
+{
+	blkdev_trig_stats.start_ns = ktime_get_ns();
+
+	blkdev_trig_debugfs = debugfs_create_dir("ledtrig-blkdev", NULL);
+
+	debugfs_create_bool("stats_enabled", 0600, blkdev_trig_debugfs,
+			    &blkdev_trig_stats_enabled);
+	debugfs_create_file("stats", 0400, blkdev_trig_debugfs, NULL,
+			    &blkdev_trig_stats_fops);
+	debugfs_create_file("devices", 0444, blkdev_trig_debugfs, NULL,
+			    &blkdev_trig_devices_fops);
+	debugfs_create_file_unsafe("stats_reset", 0200, blkdev_trig_debugfs,
+				   NULL, &blkdev_trig_stats_reset_fops);
+	debugfs_create_file_unsafe("bench_leds", 0600, blkdev_trig_debugfs,
+				   NULL, &blkdev_trig_bench_leds_fops);
+	debugfs_create_file("bench_link", 0200, blkdev_trig_debugfs, NULL,
+			    &blkdev_trig_bench_link_fops);
+}
+
+/**
+ * blkdev_trig_debugfs_exit() - Remove the trigger's &debugfs files and any
+ *	dummy LEDs.
+ */
+static void blkdev_trig_debugfs_exit(void)
+{
+	debugfs_remove_recursive(blkdev_trig_debugfs);
+
+	mutex_lock(&blkdev_trig_bench_mutex);
+	blkdev_trig_bench_remove();
+	mutex_unlock(&blkdev_trig_bench_mutex);
+}
+
+#else	/* CONFIG_DEBUG_FS */
+
+static void __init blkdev_trig_debugfs_init(void)
+{
+}
+
+static void blkdev_trig_debugfs_exit(void)
+{
+}
+
+#endif	/* CONFIG_DEBUG_FS */
+
+/**
+ * blkdev_trig_find_block_class() - Learn the block device class and the
+ *	device type of whole disks.
+ *
+ * The block device class isn't exported to modules, but it is needed to find
+ * block devices by name or number without opening them; the disk device type
+ * identifies the disks of SCSI devices.  A disk is allocated (but never added,
+ * so no block device is registered, let alone opened) just to read the class
+ * and type that the block layer gives it.
+ *
+ * Context:	Process context.
+ * Return:	&0 on success, &-ENOMEM on failure.
+ */
+static int __init blkdev_trig_find_block_class(void)
+{
+	struct gendisk *disk;
+
+	disk = blk_alloc_disk(NUMA_NO_NODE);
+	if (disk == NULL)
+		return -ENOMEM;
+
+	blkdev_trig_block_class = disk_to_dev(disk)->class;
+	blkdev_trig_disk_type = disk_to_dev(disk)->type;
+	put_disk(disk);
+
+	return 0;
+}
+
 /**
  * blkdev_trig_init() - Block device LED trigger initialization.
  *
- * Registers the ``blkdev`` LED trigger.
+ * Learns the block device class, creates the trigger's slab caches and
+ * workqueue, looks for the tracepoint used by event-driven LEDs, registers the
+ * ``blkdev`` LED trigger, and creates the &debugfs benchmarking files.
  *
  * Return:	&0 on success, negative &errno on failure.
  */
 static int __init blkdev_trig_init(void)
 {
-	return led_trigger_register(&blkdev_trig_trigger);
+	unsigned int flags = 0;
+	int err;
+
+	err = blkdev_trig_find_block_class();
+	if (err)
+		return err;
+
+	err = -ENOMEM;
+
+	blkdev_trig_btb_cache = KMEM_CACHE(blkdev_trig_bdev, SLAB_HWCACHE_ALIGN);
+	if (blkdev_trig_btb_cache == NULL)
+		return -ENOMEM;
+
+	blkdev_trig_btl_cache = KMEM_CACHE(blkdev_trig_led, SLAB_HWCACHE_ALIGN);
+	if (blkdev_trig_btl_cache == NULL)
+		goto error_destroy_btb_cache;
+
+	if (blkdev_trig_wq_highpri)
+		flags |= WQ_HIGHPRI;
+	if (blkdev_trig_wq_unbound)
+		flags |= WQ_UNBOUND | WQ_SYSFS;
+	if (blkdev_trig_wq_freezable)
+		flags |= WQ_FREEZABLE;
+
+	/* The delayed work never runs concurrently with itself anyway */
+	blkdev_trig_wq = alloc_workqueue("ledtrig-blkdev", flags, 1);
+	if (blkdev_trig_wq == NULL)
+		goto error_destroy_btl_cache;
+
+	hrtimer_init(&blkdev_trig_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	blkdev_trig_timer.function = blkdev_trig_timer_fn;
+
+	err = rhashtable_init(&blkdev_trig_names, &blkdev_trig_names_params);
+	if (err)
+		goto error_destroy_wq;
+
+	blkdev_trig_event_init();
+
+	err = register_pm_notifier(&blkdev_trig_pm_nb);
+	if (err)
+		goto error_destroy_names;
+
+	err = led_trigger_register(&blkdev_trig_trigger);
+	if (err)
+		goto error_unregister_pm;
+
+	blkdev_trig_hotplug_init();
+	blkdev_trig_debugfs_init();
+	return 0;
+
+error_unregister_pm:
+	unregister_pm_notifier(&blkdev_trig_pm_nb);
+error_destroy_names:
+	rhashtable_destroy(&blkdev_trig_names);
+error_destroy_wq:
+	destroy_workqueue(blkdev_trig_wq);
+error_destroy_btl_cache:
+	kmem_cache_destroy(blkdev_trig_btl_cache);
+error_destroy_btb_cache:
+	kmem_cache_destroy(blkdev_trig_btb_cache);
+	return err;
 }
 module_init(blkdev_trig_init);
 
 /**
  * blkdev_trig_exit() - Block device LED trigger module exit.
  *
- * Unregisters the ``blkdev`` LED trigger.
+ * Removes the &debugfs files and any dummy LEDs, stops handling new SCSI
+ * devices, and unregisters the ``blkdev`` LED trigger and the PM notifier.
+ * Unregistering the trigger removes all links, but an event may have kicked the
+ * delayed work after the last link was removed, so ensure that it isn't still
+ * pending before destroying the workqueue.  BTBs and BTLs are freed by RCU
+ * callbacks, which must finish before their caches are destroyed.
  */
 static void __exit blkdev_trig_exit(void)
 {
+	blkdev_trig_debugfs_exit();
+	blkdev_trig_hotplug_exit();
 	led_trigger_unregister(&blkdev_trig_trigger);
+	unregister_pm_notifier(&blkdev_trig_pm_nb);
+	blkdev_trig_cancel_work();
+	rhashtable_destroy(&blkdev_trig_names);
+	destroy_workqueue(blkdev_trig_wq);
+	rcu_barrier();  /* pending blkdev_trig_free_btb/btl() callbacks */
+	kmem_cache_destroy(blkdev_trig_btl_cache);
+	kmem_cache_destroy(blkdev_trig_btb_cache);
 }
 module_exit(blkdev_trig_exit);
 
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+/*
+ *	Block device LED trigger - batched LED updates
+ *
+ *	Copyright 2021-2023 Ian Pilcher <arequipeno@gmail.com>
+ */
+
+#ifndef _LEDTRIG_BLKDEV_H
+#define _LEDTRIG_BLKDEV_H
+
+#include <linux/leds.h>
+
+/**
+ * struct blkdev_trig_blink - A blink requested by the trigger.
+ * @led:	The LED
+ * @delay_on:	Duration of the blink (milliseconds)
+ */
+struct blkdev_trig_blink {
+	struct led_classdev	*led;
+	unsigned long		delay_on;
+};
+
+/**
+ * struct blkdev_trig_batch - LED driver callbacks for batched blinks.
+ * @owns:	Returns whether the driver can blink an LED as part of a batch.
+ *		Blinks of other LEDs use led_blink_set_oneshot().
+ * @blink:	Blinks each LED in an array once, for the requested duration.
+ *
+ * All of the blinks from one check of the trigger's block devices are passed
+ * to @blink together, so that the driver can update all of its LEDs with as
+ * few hardware writes as possible.  Both callbacks are called with the RCU
+ * read lock held, so they must not sleep.
+ */
+struct blkdev_trig_batch {
+	bool	(*owns)(const struct led_classdev *led);
+	void	(*blink)(const struct blkdev_trig_blink *blinks,
+			 unsigned int nr_blinks);
+};
+
+int blkdev_trig_batch_register(const struct blkdev_trig_batch *batch);
+void blkdev_trig_batch_unregister(const struct blkdev_trig_batch *batch);
+
+#endif	/* _LEDTRIG_BLKDEV_H */
@@ -6,14 +6,22 @@
  * Copyright 2013, 2021-2024 Ian Pilcher <arequipeno@gmail.com>
  */
 
+#include <linux/async.h>
 #include <linux/platform_device.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/leds.h>
 #include <linux/leds-pca9532.h>
 #include <linux/i2c.h>
 #include <linux/pci.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
 #include <linux/gpio/driver.h>
 #include <linux/version.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+
+#include "ledtrig-blkdev.h"
 
 /*
  * Disk activity LEDs are controlled by GPIO pins on the ICH10R chipset
@@ -54,31 +62,33 @@ static struct gpio_led n5550_ich_gpio_leds[5] = {
 	},
 };
 
+/* Hardware blinking (GPO_BLINK) - see below */
+static int n5550_ich_gpio_led_blink_set(struct gpio_desc *desc, int state,
+					unsigned long *delay_on,
+					unsigned long *delay_off);
+
 static struct gpio_led_platform_data n5550_ich_gpio_led_data = {
 	.num_leds			= ARRAY_SIZE(n5550_ich_gpio_leds),
 	.leds				= n5550_ich_gpio_leds,
+	.gpio_blink_set			= n5550_ich_gpio_led_blink_set,
 };
 
-static struct platform_device n5550_ich_gpio_led_pdev = {
-	.name				= "leds-gpio",
-	.id				= -1,
-	.dev.platform_data		= &n5550_ich_gpio_led_data,
-};
+/* Allocated dynamically, so it can be re-registered if gpio_ich rebinds */
+static struct platform_device *n5550_ich_gpio_led_pdev;
 
 /* GPIO numbers of LEDS are not contiguous */
-static const unsigned __initdata n5550_ich_gpio_led_offsets[5] = {
+static const unsigned n5550_ich_gpio_led_offsets[5] = {
 	0, 2, 3, 4, 5,
 };
 
-static int __init n5550_get_ich_gpiobase(void)
+static int n5550_get_ich_gpiobase(void)
 {
 	struct gpio_device *gdev;
 	int base;
 
-	if ((gdev = gpio_device_find_by_label("gpio_ich")) == NULL) {
-		pr_warn("Couldn't find ICH GPIO device\n");
-		return -ENODEV;
-	}
+	/* Setup is retried when gpio_ich binds */
+	if ((gdev = gpio_device_find_by_label("gpio_ich")) == NULL)
+		return -EPROBE_DEFER;
 
 	base = gpio_device_get_base(gdev);
 	gpio_device_put(gdev);
@@ -93,25 +103,64 @@ static int __init n5550_get_ich_gpiobase(void)
 	return base;
 }
 
-static int __init n5550_ich_gpio_led_setup(void)
+/* Base GPIO number of gpio_ich (set by n5550_ich_gpio_*_setup) */
+static int n5550_ich_gpio_base;
+
+/*
+ * A managed device link from leds-gpio to gpio_ich makes the driver core unbind
+ * leds-gpio before gpio_ich's driver unbinds; the (unbound) leds-gpio device is
+ * unregistered later, outside the platform bus notifier chain.
+ */
+static int n5550_ich_gpio_led_link(void)
+{
+	struct gpio_device *gdev;
+	struct device_link *link;
+
+	if ((gdev = gpio_device_find_by_label("gpio_ich")) == NULL)
+		return -EPROBE_DEFER;
+
+	link = device_link_add(&n5550_ich_gpio_led_pdev->dev,
+			       gpio_device_to_device(gdev)->parent,
+			       DL_FLAG_AUTOREMOVE_CONSUMER);
+	gpio_device_put(gdev);
+
+	return link != NULL ? 0 : -EINVAL;
+}
+
+static int n5550_ich_gpio_led_setup(void)
 {
 	unsigned i;
-	int base;
+	int base, ret;
 
 	if ((base = n5550_get_ich_gpiobase()) < 0)
 		return base;
 
+	n5550_ich_gpio_base = base;
+
 	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_leds); ++i) {
 		n5550_ich_gpio_leds[i].gpio = base +
 					      n5550_ich_gpio_led_offsets[i];
 	}
 
-	return platform_device_register(&n5550_ich_gpio_led_pdev);
+	n5550_ich_gpio_led_pdev = platform_device_register_data(NULL,
+					"leds-gpio", PLATFORM_DEVID_NONE,
+					&n5550_ich_gpio_led_data,
+					sizeof(n5550_ich_gpio_led_data));
+	if (IS_ERR(n5550_ich_gpio_led_pdev))
+		return PTR_ERR(n5550_ich_gpio_led_pdev);
+
+	if ((ret = n5550_ich_gpio_led_link()) != 0) {
+		pr_warn("Failed to link leds-gpio to gpio_ich (%d)\n", ret);
+		platform_device_unregister(n5550_ich_gpio_led_pdev);
+		return ret;
+	}
+
+	return 0;
 }
 
 static void n5550_ich_gpio_led_cleanup(void)
 {
-	platform_device_unregister(&n5550_ich_gpio_led_pdev);
+	platform_device_unregister(n5550_ich_gpio_led_pdev);
 }
 
 /*
@@ -129,6 +178,9 @@ static void n5550_ich_gpio_led_cleanup(void)
 
 /* I/O port offsets - from drivers/gpio/gpio-ich.c */
 #define N5550_ICH_GPIO_USE_SEL_0     	0x00
+#define N5550_ICH_GPIO_IO_SEL_0		0x04
+#define N5550_ICH_GPIO_LVL_0		0x0c
+#define N5550_ICH_GPIO_BLINK_0		0x18
 #define N5550_ICH_GPIO_USE_SEL_1     	0x30
 #define N5550_ICH_GPIO_USE_SEL_2	0x40
 
@@ -144,7 +196,10 @@ static void n5550_ich_gpio_led_cleanup(void)
 				)
 #define N5550_ICH_GPIO_PINS_1		(1 << (34 - 32))
 
-static int __init n5550_ich_gpio_setup(void)
+/* GPIO I/O port base (set by n5550_ich_gpio_setup) */
+static u32 n5550_ich_gpio_io_base;
+
+static int n5550_ich_gpio_setup(void)
 {
 	struct pci_dev *dev;
 	u32 gpio_io_base, gpio_pins;
@@ -167,14 +222,347 @@ static int __init n5550_ich_gpio_setup(void)
 	gpio_pins |= N5550_ICH_GPIO_PINS_1;
 	outl(gpio_pins, gpio_io_base + N5550_ICH_GPIO_USE_SEL_1);
 
+	n5550_ich_gpio_io_base = gpio_io_base;
+
 	pci_dev_put(dev);
 	return 0;
 }
 
+/*
+ * Optionally, the disk activity LEDs can be driven directly, rather than
+ * through leds-gpio, gpiolib and gpio-ich.  (The pins are still requested from
+ * gpiolib, so nothing else can claim them.)  All 5 LED pins are in GPIO_LVL_0,
+ * so any number of them can be changed with a single read-modify-write of that
+ * register.  (gpio-ich does its own read-modify-write of the register, under
+ * its own lock, if another pin in it is changed through gpiolib, so no other
+ * output pins in GPIO_LVL_0 should be used while this is enabled.)
+ *
+ * Whether or not the LEDs are driven directly, they support hardware blinking
+ * (blink_set), using the chipset's GPO_BLINK register.  The blink rate is fixed
+ * at approximately 0.5 seconds on and 0.5 seconds off, so other rates are
+ * rejected (and blinked in software by the LED core).  gpio-ich only touches
+ * GPO_BLINK in ichx_gpio_direction_output(), which clears the pin's bit; that
+ * happens when the pins are requested, before any LED can blink.  When
+ * the LEDs are driven through leds-gpio, only GPO_BLINK is written here; their
+ * levels are set through gpiolib, so GPIO_LVL_0 is never written behind
+ * gpio-ich's back.
+ */
+
+static bool n5550_direct_gpio_leds;
+module_param_named(direct_gpio_leds, n5550_direct_gpio_leds, bool, 0444);
+MODULE_PARM_DESC(direct_gpio_leds,
+		 "Drive the disk activity LEDs directly, rather than with leds-gpio; their blinks are batched once ledtrig-blkdev is loaded (default: N)");
+
+struct n5550_ich_gpio_led {
+	struct led_classdev	cdev;
+	u32			mask;
+	/* Batched blinks (protected by n5550_ich_gpio_blink_lock) */
+	bool			lit;
+	unsigned long		off_at;
+};
+
+static struct n5550_ich_gpio_led n5550_ich_gpio_direct_leds[5];
+
+#define N5550_ICH_GPIO_BLINK_MSEC	500
+
+/* Serializes read-modify-write of GPIO_LVL_0 and GPO_BLINK */
+static DEFINE_SPINLOCK(n5550_ich_gpio_lock);
+
+/* LED pins with GPO_BLINK set (protected by n5550_ich_gpio_lock) */
+static u32 n5550_ich_gpio_blinking;
+
+static void n5550_ich_gpio_write_blink(u32 mask, u32 blink)
+{
+	u32 reg;
+
+	if ((n5550_ich_gpio_blinking & mask) == blink)
+		return;
+
+	reg = inl(n5550_ich_gpio_io_base + N5550_ICH_GPIO_BLINK_0);
+	outl((reg & ~mask) | blink,
+	     n5550_ich_gpio_io_base + N5550_ICH_GPIO_BLINK_0);
+
+	n5550_ich_gpio_blinking = (n5550_ich_gpio_blinking & ~mask) | blink;
+}
+
+/*
+ * Turn on the LEDs in on, and turn off the other LEDs in mask.  LEDs in blink
+ * (which must also be in on) blink; blinking of the other LEDs in mask stops.
+ */
+static void n5550_ich_gpio_update(u32 mask, u32 on, u32 blink)
+{
+	unsigned long flags;
+	u32 old, new;
+
+	on &= mask;
+	blink &= on;
+
+	spin_lock_irqsave(&n5550_ich_gpio_lock, flags);
+
+	/* Stop blinking before setting the level, start blinking after */
+	n5550_ich_gpio_write_blink(mask & ~blink, 0);
+
+	/* LEDs are active low */
+	old = inl(n5550_ich_gpio_io_base + N5550_ICH_GPIO_LVL_0);
+	new = (old | mask) & ~on;
+
+	if (new != old)
+		outl(new, n5550_ich_gpio_io_base + N5550_ICH_GPIO_LVL_0);
+
+	n5550_ich_gpio_write_blink(blink, blink);
+
+	spin_unlock_irqrestore(&n5550_ich_gpio_lock, flags);
+}
+
+static void n5550_ich_gpio_brightness_set(struct led_classdev *cdev,
+					  enum led_brightness brightness)
+{
+	struct n5550_ich_gpio_led *led =
+			container_of(cdev, struct n5550_ich_gpio_led, cdev);
+
+	n5550_ich_gpio_update(led->mask, brightness == LED_OFF ? 0 : led->mask, 0);
+}
+
+/* Checks (or defaults) the requested rate; GPO_BLINK only has one */
+static int n5550_ich_gpio_blink_rate(unsigned long *delay_on,
+				     unsigned long *delay_off)
+{
+	if (*delay_on == 0 && *delay_off == 0) {
+		*delay_on = N5550_ICH_GPIO_BLINK_MSEC;
+		*delay_off = N5550_ICH_GPIO_BLINK_MSEC;
+	}
+
+	if (*delay_on != N5550_ICH_GPIO_BLINK_MSEC ||
+			*delay_off != N5550_ICH_GPIO_BLINK_MSEC)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int n5550_ich_gpio_blink_set(struct led_classdev *cdev,
+				    unsigned long *delay_on,
+				    unsigned long *delay_off)
+{
+	struct n5550_ich_gpio_led *led =
+			container_of(cdev, struct n5550_ich_gpio_led, cdev);
+	int ret;
+
+	if ((ret = n5550_ich_gpio_blink_rate(delay_on, delay_off)) != 0)
+		return ret;
+
+	n5550_ich_gpio_update(led->mask, led->mask, led->mask);
+	return 0;
+}
+
+/* Sets or clears the GPO_BLINK bits in mask, without touching GPIO_LVL_0 */
+static void n5550_ich_gpio_set_blink(u32 mask, u32 blink)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&n5550_ich_gpio_lock, flags);
+	n5550_ich_gpio_write_blink(mask, blink & mask);
+	spin_unlock_irqrestore(&n5550_ich_gpio_lock, flags);
+}
+
+/*
+ * leds-gpio also calls this to turn off blinking (state != GPIO_LED_BLINK).
+ * The level is set through gpiolib (desc is active low), so gpio-ich's own
+ * read-modify-write of GPIO_LVL_0 isn't raced.
+ */
+static int n5550_ich_gpio_led_blink_set(struct gpio_desc *desc, int state,
+					unsigned long *delay_on,
+					unsigned long *delay_off)
+{
+	u32 mask = 1 << (desc_to_gpio(desc) - n5550_ich_gpio_base);
+	int ret;
+
+	if (state == GPIO_LED_BLINK) {
+		if ((ret = n5550_ich_gpio_blink_rate(delay_on, delay_off)) != 0)
+			return ret;
+		gpiod_set_value(desc, 1);
+		n5550_ich_gpio_set_blink(mask, mask);
+		return 0;
+	}
+
+	/* Stop blinking before setting the level */
+	n5550_ich_gpio_set_blink(mask, 0);
+	gpiod_set_value(desc, state == GPIO_LED_NO_BLINK_HIGH);
+	return 0;
+}
+
+/*
+ * Batched blinks (see below) turn LEDs on directly; a single timer turns them
+ * off again, with one register write for all LEDs whose blinks have ended.
+ */
+
+/*
+ * Held across the register writes as well as the lit/off_at updates, so the
+ * timer can't turn off an LED that a new blink has just turned on again.
+ * Nests outside n5550_ich_gpio_lock.
+ */
+static DEFINE_SPINLOCK(n5550_ich_gpio_blink_lock);
+
+static void n5550_ich_gpio_blink_timer_fn(struct timer_list *timer);
+static DEFINE_TIMER(n5550_ich_gpio_blink_timer, n5550_ich_gpio_blink_timer_fn);
+
+/* Caller must hold n5550_ich_gpio_blink_lock */
+static void n5550_ich_gpio_blink_arm(void)
+{
+	struct n5550_ich_gpio_led *led;
+	unsigned long next = 0;
+	bool lit = false;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_direct_leds); ++i) {
+		led = &n5550_ich_gpio_direct_leds[i];
+		if (led->lit && (!lit || time_before(led->off_at, next))) {
+			next = led->off_at;
+			lit = true;
+		}
+	}
+
+	if (lit)
+		mod_timer(&n5550_ich_gpio_blink_timer, next);
+}
+
+static void n5550_ich_gpio_blink_timer_fn(struct timer_list *timer)
+{
+	struct n5550_ich_gpio_led *led;
+	unsigned long flags;
+	u32 off = 0;
+	unsigned i;
+
+	spin_lock_irqsave(&n5550_ich_gpio_blink_lock, flags);
+
+	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_direct_leds); ++i) {
+		led = &n5550_ich_gpio_direct_leds[i];
+		if (led->lit && !time_before(jiffies, led->off_at)) {
+			led->lit = false;
+			off |= led->mask;
+		}
+	}
+
+	n5550_ich_gpio_update(off, 0, 0);
+	n5550_ich_gpio_blink_arm();
+
+	spin_unlock_irqrestore(&n5550_ich_gpio_blink_lock, flags);
+}
+
+/* Blink the LEDs in on once, until their off_at times */
+static void n5550_ich_gpio_batch_blink(u32 on)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&n5550_ich_gpio_blink_lock, flags);
+	n5550_ich_gpio_update(on, on, 0);
+	n5550_ich_gpio_blink_arm();
+	spin_unlock_irqrestore(&n5550_ich_gpio_blink_lock, flags);
+}
+
+static void n5550_ich_gpio_direct_free(unsigned nr_pins)
+{
+	while (nr_pins-- > 0)
+		gpio_free(n5550_ich_gpio_base + n5550_ich_gpio_led_offsets[nr_pins]);
+}
+
+static void n5550_ich_gpio_direct_cleanup(unsigned nr_leds)
+{
+	u32 mask = 0;
+	unsigned i;
+
+	while (nr_leds-- > 0) {
+		led_classdev_unregister(&n5550_ich_gpio_direct_leds[nr_leds].cdev);
+		mask |= n5550_ich_gpio_direct_leds[nr_leds].mask;
+	}
+
+	timer_delete_sync(&n5550_ich_gpio_blink_timer);
+
+	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_direct_leds); ++i)
+		n5550_ich_gpio_direct_leds[i].lit = false;
+
+	n5550_ich_gpio_update(mask, 0, 0);
+	n5550_ich_gpio_direct_free(ARRAY_SIZE(n5550_ich_gpio_direct_leds));
+}
+
+static int n5550_ich_gpio_direct_setup(void)
+{
+	struct n5550_ich_gpio_led *led;
+	unsigned i;
+	int ret;
+
+	if ((ret = n5550_get_ich_gpiobase()) < 0)
+		return ret;
+
+	n5550_ich_gpio_base = ret;
+
+	/*
+	 * Reserve the pins while they're driven directly.  gpio-ich makes them
+	 * outputs, with the LEDs off (active low), under its own lock.
+	 */
+	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_direct_leds); ++i) {
+		ret = gpio_request_one(n5550_ich_gpio_base +
+						n5550_ich_gpio_led_offsets[i],
+				       GPIOF_OUT_INIT_HIGH,
+				       n5550_ich_gpio_leds[i].name);
+		if (ret != 0) {
+			n5550_ich_gpio_direct_free(i);
+			return ret;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_direct_leds); ++i) {
+
+		led = &n5550_ich_gpio_direct_leds[i];
+		led->mask = 1 << n5550_ich_gpio_led_offsets[i];
+		led->cdev.name = n5550_ich_gpio_leds[i].name;
+		led->cdev.default_trigger = n5550_def_trigger;
+		led->cdev.max_brightness = 1;
+		led->cdev.brightness_set = n5550_ich_gpio_brightness_set;
+		led->cdev.blink_set = n5550_ich_gpio_blink_set;
+
+		ret = led_classdev_register(NULL, &led->cdev);
+		if (ret != 0) {
+			n5550_ich_gpio_direct_cleanup(i);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Other LEDs are controlled by 2 NXP PCA9532 dimmers
+ *
+ * Each PCA9532 has 2 PWM channels.  The leds-pca9532 driver uses PWM0 for
+ * dimming (any brightness between LED_OFF and LED_FULL) and PWM1 for hardware
+ * blinking (blink_set), so the channels are set up for those uses.  The
+ * prescaler sets the period of a channel -- (PSC + 1) / 152 seconds -- and the
+ * PWM register sets its duty cycle (PWM / 256).  PWM0 runs at the maximum
+ * frequency, so dimmed LEDs don't flicker.  The initial duty cycle of PWM0 and
+ * the initial period of PWM1 can be set with module parameters; both are
+ * changed by the driver as LEDs are dimmed or blinked.
+ *
+ * Because PWM0 is shared, all dimmed LEDs on a PCA9532 have the same brightness
+ * -- whichever was set last.  The blkdev trigger's intensity mode therefore
+ * can't show a separate I/O rate for each disk on these LEDs.  (The ICH GPIO
+ * disk activity LEDs are on/off, so intensity mode shows each disk's rate as
+ * blink duration on them.)
  */
 
+#define N5550_PCA9532_DIM_PSC		0	/* 152 Hz */
+#define N5550_PCA9532_DIM_PWM_DEF	64	/* 25% */
+#define N5550_PCA9532_BLINK_PSC_DEF	151	/* 1 second */
+#define N5550_PCA9532_BLINK_PWM		128	/* 50% */
+
+static unsigned char n5550_pca9532_dim_pwm = N5550_PCA9532_DIM_PWM_DEF;
+module_param_named(dim_pwm, n5550_pca9532_dim_pwm, byte, 0444);
+MODULE_PARM_DESC(dim_pwm, "Initial PCA9532 PWM0 (dimming) duty cycle (0-255)");
+
+static unsigned char n5550_pca9532_blink_psc = N5550_PCA9532_BLINK_PSC_DEF;
+module_param_named(blink_psc, n5550_pca9532_blink_psc, byte, 0444);
+MODULE_PARM_DESC(blink_psc,
+		 "Initial PCA9532 PWM1 (blink) period, in 1/152 seconds, minus 1");
+
 static struct pca9532_platform_data n5550_pca9532_0_pdata = {
 	.leds 	= {
 			{
@@ -236,8 +624,8 @@ static struct pca9532_platform_data n5550_pca9532_0_pdata = {
                                 .type   = PCA9532_TYPE_NONE,
                         },
 		},
-	.pwm	= { 0, 0 },
-	.psc	= { 0, 0 },
+	.pwm	= { N5550_PCA9532_DIM_PWM_DEF, N5550_PCA9532_BLINK_PWM },
+	.psc	= { N5550_PCA9532_DIM_PSC, N5550_PCA9532_BLINK_PSC_DEF },
 };
 
 static struct i2c_board_info n5550_pca9532_0_info = {
@@ -307,8 +695,8 @@ static struct pca9532_platform_data n5550_pca9532_1_pdata = {
 				.state	= PCA9532_OFF,
                         },
 		},
-        .pwm    	= { 0, 0 },
-        .psc    	= { 0, 0 },
+	.pwm		= { N5550_PCA9532_DIM_PWM_DEF, N5550_PCA9532_BLINK_PWM },
+	.psc		= { N5550_PCA9532_DIM_PSC, N5550_PCA9532_BLINK_PSC_DEF },
 };
 
 static struct i2c_board_info n5550_pca9532_1_info = {
@@ -316,89 +704,802 @@ static struct i2c_board_info n5550_pca9532_1_info = {
         .platform_data          = &n5550_pca9532_1_pdata,
 };
 
-static struct i2c_client *n5550_pca9532_0_client, *n5550_pca9532_1_client;
+/*
+ * If batch_leds is set, the disk status LEDs (the only LEDs on the first
+ * PCA9532) are driven directly by this module, rather than by leds-pca9532.
+ * Like direct_gpio_leds, this is opt-in.
+ *
+ * leds-pca9532 does a separate read-modify-write of an LED selector (LS)
+ * register for every brightness change, so changing all 5 disk status LEDs
+ * costs 10 serialized SMBus transactions.  Here, brightness changes (and
+ * blink_set) only update a shadow copy of the chip's registers; a work item
+ * writes each register that has changed once per update window.  Changing all
+ * 5 LEDs at once costs 2 SMBus writes, and the LEDs change simultaneously.
+ */
+
+static bool n5550_batch_leds;
+module_param_named(batch_leds, n5550_batch_leds, bool, 0444);
+MODULE_PARM_DESC(batch_leds,
+		 "Coalesce I2C writes for the disk status LEDs; their blinks are batched once ledtrig-blkdev is loaded (default: N)");
 
-static int __init n5550_pca9532_setup(void)
+/* PCA9532 registers - from drivers/leds/leds-pca9532.c */
+#define N5550_PCA9532_REG_PSC(i)	(0x02 + (i) * 2)
+#define N5550_PCA9532_REG_PWM(i)	(0x03 + (i) * 2)
+#define N5550_PCA9532_REG_LS(i)		(0x06 + (i))
+#define N5550_PCA9532_NR_LS		4
+
+/* Update window for coalescing register writes (milliseconds) */
+#define N5550_PCA9532_BATCH_MSEC	5
+
+struct n5550_pca9532_bank {
+	struct i2c_client	*client;
+	spinlock_t		lock;
+	/* Desired register values (protected by lock) */
+	u8			psc[2];
+	u8			pwm[2];
+	u8			ls[N5550_PCA9532_NR_LS];
+	/* Register values last written (only accessed by flush work) */
+	u8			hw_psc[2];
+	u8			hw_pwm[2];
+	u8			hw_ls[N5550_PCA9532_NR_LS];
+	struct delayed_work	flush;
+	/* Ends batched blinks */
+	struct timer_list	blink_timer;
+};
+
+struct n5550_pca9532_led {
+	struct led_classdev		cdev;
+	struct n5550_pca9532_bank	*bank;
+	unsigned			pin;
+	/* Batched blinks (protected by bank->lock) */
+	bool				lit;
+	unsigned long			off_at;
+};
+
+static struct n5550_pca9532_bank n5550_pca9532_0_bank;
+static struct n5550_pca9532_led n5550_pca9532_0_leds[5];
+
+static int n5550_pca9532_write(struct n5550_pca9532_bank *bank, u8 reg,
+			       u8 value, u8 *hw_value)
 {
-	struct i2c_adapter *adapter;
-	struct pci_dev *dev;
+	int ret;
 
-	dev = pci_get_device(N5550_ICH_PCI_VENDOR, N5550_ICH_I2C_PCI_DEV, NULL);
-	if (dev == NULL)
-	    return -ENODEV;
+	if (value == *hw_value)
+		return 0;
 
-	adapter = pci_get_drvdata(dev);
-	if (adapter == NULL) {
-		pci_dev_put(dev);
-		return -ENODEV;
+	ret = i2c_smbus_write_byte_data(bank->client, reg, value);
+	if (ret == 0)
+		*hw_value = value;
+
+	return ret;
+}
+
+static void n5550_pca9532_flush(struct work_struct *work)
+{
+	struct n5550_pca9532_bank *bank;
+	u8 psc[2], pwm[2], ls[N5550_PCA9532_NR_LS];
+	unsigned i;
+	int ret = 0;
+
+	bank = container_of(to_delayed_work(work),
+			    struct n5550_pca9532_bank, flush);
+
+	spin_lock_irq(&bank->lock);
+	memcpy(psc, bank->psc, sizeof psc);
+	memcpy(pwm, bank->pwm, sizeof pwm);
+	memcpy(ls, bank->ls, sizeof ls);
+	spin_unlock_irq(&bank->lock);
+
+	/* Set up the PWM channels before any LED is switched to them */
+	for (i = 0; i < 2; ++i) {
+		ret |= n5550_pca9532_write(bank, N5550_PCA9532_REG_PSC(i),
+					   psc[i], &bank->hw_psc[i]);
+		ret |= n5550_pca9532_write(bank, N5550_PCA9532_REG_PWM(i),
+					   pwm[i], &bank->hw_pwm[i]);
 	}
 
-	if (!try_module_get(adapter->owner)) {
-		pci_dev_put(dev);
-		return -EBUSY;
+	for (i = 0; i < N5550_PCA9532_NR_LS; ++i) {
+		ret |= n5550_pca9532_write(bank, N5550_PCA9532_REG_LS(i),
+					   ls[i], &bank->hw_ls[i]);
 	}
 
-	n5550_pca9532_0_client
-			= i2c_new_client_device(adapter, &n5550_pca9532_0_info);
-	if (n5550_pca9532_0_client == NULL) {
-		module_put(adapter->owner);
-		pci_dev_put(dev);
-		return -ENODEV;
+	if (ret != 0)
+		dev_warn_ratelimited(&bank->client->dev,
+				     "Failed to update LED registers\n");
+}
+
+/* Caller must hold bank->lock */
+static void n5550_pca9532_set_state(struct n5550_pca9532_led *led,
+				    enum pca9532_state state)
+{
+	struct n5550_pca9532_bank *bank = led->bank;
+	unsigned reg = led->pin / 4, shift = (led->pin % 4) * 2;
+
+	bank->ls[reg] = (bank->ls[reg] & ~(0x3 << shift)) | (state << shift);
+	schedule_delayed_work(&bank->flush,
+			      msecs_to_jiffies(N5550_PCA9532_BATCH_MSEC));
+}
+
+static void n5550_pca9532_brightness_set(struct led_classdev *cdev,
+					 enum led_brightness value)
+{
+	struct n5550_pca9532_led *led;
+	unsigned long flags;
+
+	led = container_of(cdev, struct n5550_pca9532_led, cdev);
+
+	spin_lock_irqsave(&led->bank->lock, flags);
+
+	if (value == LED_OFF) {
+		n5550_pca9532_set_state(led, PCA9532_OFF);
+	} else if (value >= cdev->max_brightness) {
+		n5550_pca9532_set_state(led, PCA9532_ON);
+	} else {
+		/* As in leds-pca9532, all dimmed LEDs share PWM0 */
+		led->bank->pwm[0] = value;
+		n5550_pca9532_set_state(led, PCA9532_PWM0);
 	}
 
-	n5550_pca9532_1_client
-			= i2c_new_client_device(adapter, &n5550_pca9532_1_info);
-	if (n5550_pca9532_1_client == NULL) {
-		i2c_unregister_device(n5550_pca9532_0_client);
-		module_put(adapter->owner);
-		pci_dev_put(dev);
-		return -ENODEV;
+	spin_unlock_irqrestore(&led->bank->lock, flags);
+}
+
+/* Hardware blinking uses PWM1; blink period is (PSC1 + 1) / 152 seconds */
+static int n5550_pca9532_blink_set(struct led_classdev *cdev,
+				   unsigned long *delay_on,
+				   unsigned long *delay_off)
+{
+	struct n5550_pca9532_led *led;
+	unsigned long period, flags;
+	unsigned psc, pwm;
+
+	led = container_of(cdev, struct n5550_pca9532_led, cdev);
+
+	if (*delay_on == 0 && *delay_off == 0) {
+		*delay_on = 500;
+		*delay_off = 500;
 	}
 
-	module_put(adapter->owner);
-	pci_dev_put(dev);
+	period = *delay_on + *delay_off;
+	if (period * 152 < 1000 || period * 152 > 256 * 1000)
+		return -EINVAL;
+
+	psc = DIV_ROUND_CLOSEST(period * 152, 1000) - 1;
+	pwm = clamp(DIV_ROUND_CLOSEST(*delay_on * 256, period), 1UL, 255UL);
+
+	spin_lock_irqsave(&led->bank->lock, flags);
+	led->bank->psc[1] = psc;
+	led->bank->pwm[1] = pwm;
+	n5550_pca9532_set_state(led, PCA9532_PWM1);
+	spin_unlock_irqrestore(&led->bank->lock, flags);
+
 	return 0;
 }
 
-static void n5550_pca9532_cleanup(void)
+/* Caller must hold bank->lock */
+static void n5550_pca9532_blink_arm(struct n5550_pca9532_bank *bank)
 {
-	i2c_unregister_device(n5550_pca9532_0_client);
-	i2c_unregister_device(n5550_pca9532_1_client);
+	struct n5550_pca9532_led *led;
+	unsigned long next = 0;
+	bool lit = false;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(n5550_pca9532_0_leds); ++i) {
+		led = &n5550_pca9532_0_leds[i];
+		if (led->lit && (!lit || time_before(led->off_at, next))) {
+			next = led->off_at;
+			lit = true;
+		}
+	}
+
+	if (lit)
+		mod_timer(&bank->blink_timer, next);
 }
 
-static int __init n5550_board_init(void)
+static void n5550_pca9532_blink_timer_fn(struct timer_list *timer)
+{
+	struct n5550_pca9532_bank *bank;
+	struct n5550_pca9532_led *led;
+	unsigned long flags;
+	unsigned i;
+
+	bank = from_timer(bank, timer, blink_timer);
+
+	spin_lock_irqsave(&bank->lock, flags);
+
+	/* All LEDs changed here are written by the same flush */
+	for (i = 0; i < ARRAY_SIZE(n5550_pca9532_0_leds); ++i) {
+		led = &n5550_pca9532_0_leds[i];
+		if (led->lit && !time_before(jiffies, led->off_at)) {
+			led->lit = false;
+			n5550_pca9532_set_state(led, PCA9532_OFF);
+		}
+	}
+
+	n5550_pca9532_blink_arm(bank);
+
+	spin_unlock_irqrestore(&bank->lock, flags);
+}
+
+static void n5550_pca9532_batch_cleanup(unsigned nr_leds)
+{
+	struct n5550_pca9532_bank *bank = &n5550_pca9532_0_bank;
+	unsigned i;
+
+	while (nr_leds-- > 0)
+		led_classdev_unregister(&n5550_pca9532_0_leds[nr_leds].cdev);
+
+	timer_shutdown_sync(&bank->blink_timer);
+
+	for (i = 0; i < ARRAY_SIZE(n5550_pca9532_0_leds); ++i)
+		n5550_pca9532_0_leds[i].lit = false;
+
+	/* Write any final state changes (LEDs turned off) */
+	flush_delayed_work(&bank->flush);
+
+	i2c_unregister_device(bank->client);
+}
+
+static int n5550_pca9532_batch_setup(struct i2c_adapter *adapter)
+{
+	struct n5550_pca9532_bank *bank = &n5550_pca9532_0_bank;
+	struct pca9532_platform_data *pdata = &n5550_pca9532_0_pdata;
+	struct n5550_pca9532_led *led;
+	unsigned i;
+	int ret = 0;
+
+	bank->client = i2c_new_dummy_device(adapter,
+					    n5550_pca9532_0_info.addr);
+	if (IS_ERR(bank->client))
+		return PTR_ERR(bank->client);
+
+	spin_lock_init(&bank->lock);
+	INIT_DELAYED_WORK(&bank->flush, n5550_pca9532_flush);
+	timer_setup(&bank->blink_timer, n5550_pca9532_blink_timer_fn, 0);
+
+	/* Initialize the chip, so that its registers match the shadow copy */
+	for (i = 0; i < 2; ++i) {
+		bank->psc[i] = bank->hw_psc[i] = pdata->psc[i];
+		bank->pwm[i] = bank->hw_pwm[i] = pdata->pwm[i];
+		ret |= i2c_smbus_write_byte_data(bank->client,
+						 N5550_PCA9532_REG_PSC(i),
+						 pdata->psc[i]);
+		ret |= i2c_smbus_write_byte_data(bank->client,
+						 N5550_PCA9532_REG_PWM(i),
+						 pdata->pwm[i]);
+	}
+
+	for (i = 0; i < N5550_PCA9532_NR_LS; ++i) {
+		bank->ls[i] = bank->hw_ls[i] = 0;  /* all LEDs off */
+		ret |= i2c_smbus_write_byte_data(bank->client,
+						 N5550_PCA9532_REG_LS(i), 0);
+	}
+
+	if (ret != 0) {
+		i2c_unregister_device(bank->client);
+		return -EIO;
+	}
+
+	/* Disk status LEDs are on PCA9532 pins 0 - 4 */
+	for (i = 0; i < ARRAY_SIZE(n5550_pca9532_0_leds); ++i) {
+
+		led = &n5550_pca9532_0_leds[i];
+		led->bank = bank;
+		led->pin = i;
+		led->cdev.name = pdata->leds[i].name;
+		led->cdev.default_trigger = pdata->leds[i].default_trigger;
+		led->cdev.max_brightness = LED_FULL;
+		led->cdev.brightness_set = n5550_pca9532_brightness_set;
+		led->cdev.blink_set = n5550_pca9532_blink_set;
+
+		ret = led_classdev_register(&bank->client->dev, &led->cdev);
+		if (ret != 0) {
+			n5550_pca9532_batch_cleanup(i);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * If ledtrig-blkdev is loaded, the blinks of all directly driven LEDs (the
+ * disk activity LEDs with direct_gpio_leds, and the disk status LEDs with
+ * batch_leds) from one activity check are passed to this module together.
+ * The disk activity LEDs are turned on with a single GPIO_LVL_0 write, and the
+ * disk status LEDs with a single flush of the PCA9532 LS registers.  Other LEDs
+ * are blinked individually by the trigger, as before.
+ *
+ * This module is usually loaded (from its DMI alias) before ledtrig-blkdev, so
+ * if the trigger isn't loaded yet, a module notifier registers the batch when
+ * it is.
+ */
+
+static struct n5550_ich_gpio_led *
+n5550_ich_gpio_batch_led(const struct led_classdev *cdev)
+{
+	unsigned i;
+
+	if (!n5550_direct_gpio_leds)
+		return NULL;
+
+	for (i = 0; i < ARRAY_SIZE(n5550_ich_gpio_direct_leds); ++i) {
+		if (cdev == &n5550_ich_gpio_direct_leds[i].cdev)
+			return &n5550_ich_gpio_direct_leds[i];
+	}
+
+	return NULL;
+}
+
+static struct n5550_pca9532_led *
+n5550_pca9532_batch_led(const struct led_classdev *cdev)
+{
+	unsigned i;
+
+	if (!n5550_batch_leds)
+		return NULL;
+
+	for (i = 0; i < ARRAY_SIZE(n5550_pca9532_0_leds); ++i) {
+		if (cdev == &n5550_pca9532_0_leds[i].cdev)
+			return &n5550_pca9532_0_leds[i];
+	}
+
+	return NULL;
+}
+
+static bool n5550_batch_owns(const struct led_classdev *cdev)
+{
+	return n5550_ich_gpio_batch_led(cdev) != NULL ||
+		n5550_pca9532_batch_led(cdev) != NULL;
+}
+
+static void n5550_batch_blink(const struct blkdev_trig_blink *blinks,
+			      unsigned nr_blinks)
+{
+	struct n5550_pca9532_bank *bank = &n5550_pca9532_0_bank;
+	struct n5550_ich_gpio_led *gpio_led;
+	struct n5550_pca9532_led *pca_led;
+	unsigned long flags, off_at;
+	bool pca_on = false;
+	u32 gpio_on = 0;
+	unsigned i;
+
+	for (i = 0; i < nr_blinks; ++i) {
+
+		off_at = jiffies + msecs_to_jiffies(blinks[i].delay_on);
+
+		if ((gpio_led = n5550_ich_gpio_batch_led(blinks[i].led))) {
+			spin_lock_irqsave(&n5550_ich_gpio_blink_lock, flags);
+			gpio_led->lit = true;
+			gpio_led->off_at = off_at;
+			spin_unlock_irqrestore(&n5550_ich_gpio_blink_lock,
+					       flags);
+			gpio_on |= gpio_led->mask;
+		} else if ((pca_led = n5550_pca9532_batch_led(blinks[i].led))) {
+			spin_lock_irqsave(&bank->lock, flags);
+			pca_led->lit = true;
+			pca_led->off_at = off_at;
+			n5550_pca9532_set_state(pca_led, PCA9532_ON);
+			spin_unlock_irqrestore(&bank->lock, flags);
+			pca_on = true;
+		}
+	}
+
+	if (gpio_on != 0)
+		n5550_ich_gpio_batch_blink(gpio_on);
+
+	if (pca_on) {
+		spin_lock_irqsave(&bank->lock, flags);
+		n5550_pca9532_blink_arm(bank);
+		spin_unlock_irqrestore(&bank->lock, flags);
+	}
+}
+
+static const struct blkdev_trig_batch n5550_batch = {
+	.owns	= n5550_batch_owns,
+	.blink	= n5550_batch_blink,
+};
+
+/* Holds a reference to ledtrig-blkdev while n5550_batch is registered */
+static typeof(blkdev_trig_batch_register) *n5550_batch_register;
+
+/* Serializes n5550_batch_try() (module init vs. module notifier) */
+static DEFINE_MUTEX(n5550_batch_lock);
+
+static void n5550_batch_try(void)
 {
 	int ret;
 
-	ret = n5550_pca9532_setup();
+	mutex_lock(&n5550_batch_lock);
+
+	if (n5550_batch_register != NULL)
+		goto out;
+
+	n5550_batch_register = symbol_get(blkdev_trig_batch_register);
+	if (n5550_batch_register == NULL) {
+		pr_info("Batched LED blinks enabled when ledtrig-blkdev loads\n");
+		goto out;
+	}
+
+	ret = n5550_batch_register(&n5550_batch);
 	if (ret != 0) {
-		pr_warn("n5550_pca9532_setup failed (%d)\n", ret);
-		return ret;
+		pr_warn("Failed to register LED blink batch (%d)\n", ret);
+		symbol_put(blkdev_trig_batch_register);
+		n5550_batch_register = NULL;
 	}
 
+out:
+	mutex_unlock(&n5550_batch_lock);
+}
+
+static int n5550_module_notify(struct notifier_block *nb, unsigned long action,
+				       void *data)
+{
+	struct module *mod = data;
+
+	if (action == MODULE_STATE_LIVE &&
+			strcmp(mod->name, "ledtrig_blkdev") == 0)
+		n5550_batch_try();
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block n5550_module_nb = {
+	.notifier_call	= n5550_module_notify,
+};
+
+static void __init n5550_batch_setup(void)
+{
+	/* Register the notifier first, so that the trigger's load isn't missed */
+	if (register_module_notifier(&n5550_module_nb) != 0)
+		pr_warn("Failed to register module notifier; batched blinks need ledtrig-blkdev loaded first\n");
+
+	n5550_batch_try();
+}
+
+static void n5550_batch_cleanup(void)
+{
+	typeof(blkdev_trig_batch_unregister) *unregister;
+
+	unregister_module_notifier(&n5550_module_nb);
+
+	if (n5550_batch_register == NULL)
+		return;
+
+	/* Can't fail; ledtrig-blkdev can't be unloaded while registered */
+	unregister = symbol_get(blkdev_trig_batch_unregister);
+	unregister(&n5550_batch);
+	symbol_put(blkdev_trig_batch_unregister);
+
+	symbol_put(blkdev_trig_batch_register);
+}
+
+static struct i2c_client *n5550_pca9532_0_client, *n5550_pca9532_1_client;
+
+static void __init n5550_pca9532_pwm_setup(struct pca9532_platform_data *pdata)
+{
+	pdata->pwm[0] = n5550_pca9532_dim_pwm;		/* PWM0 duty cycle */
+	pdata->psc[1] = n5550_pca9532_blink_psc;	/* PWM1 period */
+}
+
+static bool n5550_is_ich_i2c(struct device *dev)
+{
+	struct pci_dev *pdev;
+
+	if (!dev_is_pci(dev))
+		return false;
+
+	pdev = to_pci_dev(dev);
+	return pdev->vendor == N5550_ICH_PCI_VENDOR &&
+		pdev->device == N5550_ICH_I2C_PCI_DEV;
+}
+
+static int n5550_find_i2c_adapter(struct device *dev, void *data)
+{
+	struct i2c_adapter *adapter = i2c_verify_adapter(dev);
+
+	if (adapter == NULL || adapter->dev.parent == NULL ||
+			!n5550_is_ich_i2c(adapter->dev.parent))
+		return 0;
+
+	*(struct i2c_adapter **)data = adapter;
+	return 1;
+}
+
+/* Returns the ICH SMBus adapter with a reference held, or an error pointer */
+static struct i2c_adapter *n5550_get_i2c_adapter(void)
+{
+	struct i2c_adapter *adapter = NULL;
+
+	/* Setup is retried when i2c-i801 binds */
+	if (i2c_for_each_dev(&adapter, n5550_find_i2c_adapter) == 0)
+		return ERR_PTR(-EPROBE_DEFER);
+
+	adapter = i2c_get_adapter(i2c_adapter_id(adapter));
+	return adapter != NULL ? adapter : ERR_PTR(-EPROBE_DEFER);
+}
+
+static int n5550_pca9532_0_setup(struct i2c_adapter *adapter)
+{
+	if (n5550_batch_leds)
+		return n5550_pca9532_batch_setup(adapter);
+
+	n5550_pca9532_0_client = i2c_new_client_device(adapter,
+						       &n5550_pca9532_0_info);
+	return PTR_ERR_OR_ZERO(n5550_pca9532_0_client);
+}
+
+static int n5550_pca9532_1_setup(struct i2c_adapter *adapter)
+{
+	n5550_pca9532_1_client = i2c_new_client_device(adapter,
+						       &n5550_pca9532_1_info);
+	return PTR_ERR_OR_ZERO(n5550_pca9532_1_client);
+}
+
+static void n5550_pca9532_0_cleanup(void)
+{
+	if (n5550_batch_leds)
+		n5550_pca9532_batch_cleanup(ARRAY_SIZE(n5550_pca9532_0_leds));
+	else
+		i2c_unregister_device(n5550_pca9532_0_client);
+}
+
+static void n5550_pca9532_1_cleanup(void)
+{
+	i2c_unregister_device(n5550_pca9532_1_client);
+}
+
+/*
+ * Board setup runs in independent asynchronous stages -- one for each PCA9532
+ * and one for the ICH GPIO pins and disk activity LEDs -- so that a slow (or
+ * failed) SMBus transaction doesn't hold up the other LEDs.  Each stage records
+ * whether it succeeded, so that only the parts of the board that came up are
+ * cleaned up on exit.
+ *
+ * A stage whose provider (i2c-i801 or gpio_ich) hasn't bound yet returns
+ * -EPROBE_DEFER.  Bus notifiers run the stage again when its provider's driver
+ * binds, and clean it up before the provider's driver unbinds, so the module
+ * can be loaded before (or independently of) the drivers it depends on.
+ *
+ * A stage whose cleanup unregisters a device on its provider's bus can't be
+ * cleaned up from that bus's notifier, because the unregistration calls the
+ * same notifier chain.  Such a stage (defer_down) must ensure that the driver
+ * core unbinds its devices first -- see n5550_ich_gpio_led_link() -- and is
+ * cleaned up by a work item, which running the stage again waits for.
+ */
+
+static ASYNC_DOMAIN_EXCLUSIVE(n5550_async_domain);
+
+struct n5550_stage {
+	const char		*name;
+	int			(*setup)(void);
+	void			(*cleanup)(void);
+	const struct bus_type	*bus;
+	bool			(*is_provider)(struct device *dev);
+	bool			(*defer_down)(void);	/* optional */
+	struct work_struct	down_work;
+	struct mutex		lock;
+	bool			up;	/* protected by lock */
+};
+
+static int n5550_pca9532_stage_setup(int (*setup)(struct i2c_adapter *))
+{
+	struct i2c_adapter *adapter;
+	int ret;
+
+	adapter = n5550_get_i2c_adapter();
+	if (IS_ERR(adapter))
+		return PTR_ERR(adapter);
+
+	ret = setup(adapter);
+	i2c_put_adapter(adapter);
+	return ret;
+}
+
+static int n5550_pca9532_0_stage_setup(void)
+{
+	return n5550_pca9532_stage_setup(n5550_pca9532_0_setup);
+}
+
+static int n5550_pca9532_1_stage_setup(void)
+{
+	return n5550_pca9532_stage_setup(n5550_pca9532_1_setup);
+}
+
+static bool n5550_is_ich_gpio(struct device *dev)
+{
+	return strcmp(to_platform_device(dev)->name, "gpio_ich") == 0;
+}
+
+static int n5550_ich_gpio_stage_setup(void)
+{
+	int ret;
+
 	ret = n5550_ich_gpio_setup();
-	if (ret != 0) {
-		pr_warn("n5550_ich_gpio_setup failed (%d)\n", ret);
-		goto error;
+	if (ret != 0)
+		return ret;
+
+	if (n5550_direct_gpio_leds)
+		return n5550_ich_gpio_direct_setup();
+
+	return n5550_ich_gpio_led_setup();
+}
+
+/* leds-gpio mode unregisters a platform device; direct mode doesn't */
+static bool n5550_ich_gpio_defer_down(void)
+{
+	return !n5550_direct_gpio_leds;
+}
+
+static void n5550_ich_gpio_stage_cleanup(void)
+{
+	if (n5550_direct_gpio_leds)
+		n5550_ich_gpio_direct_cleanup(
+				ARRAY_SIZE(n5550_ich_gpio_direct_leds));
+	else
+		n5550_ich_gpio_led_cleanup();
+}
+
+static struct n5550_stage n5550_stages[] = {
+	{
+		.name		= "PCA9532 0",
+		.setup		= n5550_pca9532_0_stage_setup,
+		.cleanup	= n5550_pca9532_0_cleanup,
+		.bus		= &pci_bus_type,
+		.is_provider	= n5550_is_ich_i2c,
+	},
+	{
+		.name		= "PCA9532 1",
+		.setup		= n5550_pca9532_1_stage_setup,
+		.cleanup	= n5550_pca9532_1_cleanup,
+		.bus		= &pci_bus_type,
+		.is_provider	= n5550_is_ich_i2c,
+	},
+	{
+		.name		= "ICH GPIO LED",
+		.setup		= n5550_ich_gpio_stage_setup,
+		.cleanup	= n5550_ich_gpio_stage_cleanup,
+		.bus		= &platform_bus_type,
+		.is_provider	= n5550_is_ich_gpio,
+		.defer_down	= n5550_ich_gpio_defer_down,
+	},
+};
+
+static void n5550_stage_run(void *data, async_cookie_t cookie)
+{
+	struct n5550_stage *stage = data;
+	int ret;
+
+	/* Let a deferred cleanup finish before the stage is set up again */
+	flush_work(&stage->down_work);
+
+	mutex_lock(&stage->lock);
+
+	if (stage->up)
+		goto out;
+
+	ret = stage->setup();
+	if (ret == -EPROBE_DEFER)
+		pr_debug("n5550_board: %s setup deferred\n", stage->name);
+	else if (ret != 0)
+		pr_warn("%s setup failed (%d)\n", stage->name, ret);
+	else
+		stage->up = true;
+
+out:
+	mutex_unlock(&stage->lock);
+}
+
+static void n5550_stage_down(struct n5550_stage *stage)
+{
+	mutex_lock(&stage->lock);
+
+	if (stage->up) {
+		stage->cleanup();
+		stage->up = false;
+	}
+
+	mutex_unlock(&stage->lock);
+}
+
+static void n5550_stage_down_work(struct work_struct *work)
+{
+	n5550_stage_down(container_of(work, struct n5550_stage, down_work));
+}
+
+static int n5550_bus_notify(const struct bus_type *bus, unsigned long action,
+			    struct device *dev)
+{
+	struct n5550_stage *stage;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(n5550_stages); ++i) {
+
+		stage = &n5550_stages[i];
+		if (stage->bus != bus || !stage->is_provider(dev))
+			continue;
+
+		if (action == BUS_NOTIFY_BOUND_DRIVER)
+			async_schedule_domain(n5550_stage_run, stage,
+					      &n5550_async_domain);
+		else if (action != BUS_NOTIFY_UNBIND_DRIVER)
+			continue;
+		else if (stage->defer_down != NULL && stage->defer_down())
+			schedule_work(&stage->down_work);
+		else
+			n5550_stage_down(stage);
 	}
 
-	ret = n5550_ich_gpio_led_setup();
+	return NOTIFY_DONE;
+}
+
+static int n5550_pci_notify(struct notifier_block *nb, unsigned long action,
+			    void *data)
+{
+	return n5550_bus_notify(&pci_bus_type, action, data);
+}
+
+static int n5550_platform_notify(struct notifier_block *nb,
+				 unsigned long action, void *data)
+{
+	return n5550_bus_notify(&platform_bus_type, action, data);
+}
+
+static struct notifier_block n5550_pci_nb = {
+	.notifier_call	= n5550_pci_notify,
+};
+
+static struct notifier_block n5550_platform_nb = {
+	.notifier_call	= n5550_platform_notify,
+};
+
+static int __init n5550_board_init(void)
+{
+	unsigned i;
+	int ret;
+
+	n5550_pca9532_pwm_setup(&n5550_pca9532_0_pdata);
+	n5550_pca9532_pwm_setup(&n5550_pca9532_1_pdata);
+
+	for (i = 0; i < ARRAY_SIZE(n5550_stages); ++i) {
+		INIT_WORK(&n5550_stages[i].down_work, n5550_stage_down_work);
+		mutex_init(&n5550_stages[i].lock);
+	}
+
+	/* Register the notifiers first, so that no bind is missed */
+	ret = bus_register_notifier(&pci_bus_type, &n5550_pci_nb);
+	if (ret != 0)
+		return ret;
+
+	ret = bus_register_notifier(&platform_bus_type, &n5550_platform_nb);
 	if (ret != 0) {
-		pr_warn("n5550_ich_gpio_led_setup failed (%d)\n", ret);
-		goto error;
+		bus_unregister_notifier(&pci_bus_type, &n5550_pci_nb);
+		return ret;
 	}
 
-	return 0;
+	n5550_batch_setup();
 
-error:
-	n5550_pca9532_cleanup();
-	return ret;
+	for (i = 0; i < ARRAY_SIZE(n5550_stages); ++i)
+		async_schedule_domain(n5550_stage_run, &n5550_stages[i],
+				      &n5550_async_domain);
+
+	return 0;
 }
 
 static void __exit n5550_board_exit(void)
 {
-	n5550_pca9532_cleanup();
-	n5550_ich_gpio_led_cleanup();
+	unsigned i;
+
+	bus_unregister_notifier(&platform_bus_type, &n5550_platform_nb);
+	bus_unregister_notifier(&pci_bus_type, &n5550_pci_nb);
+
+	async_synchronize_full_domain(&n5550_async_domain);
+
+	n5550_batch_cleanup();
+
+	for (i = 0; i < ARRAY_SIZE(n5550_stages); ++i) {
+		flush_work(&n5550_stages[i].down_work);
+		n5550_stage_down(&n5550_stages[i]);
+	}
 }
 
 module_init(n5550_board_init);